@@ -0,0 +1,656 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <core.hpp>
+#include "component_allocator.hpp"
+#include "containers.hpp"
+#include "ecs.hpp"
+
+namespace atom::ecs {
+
+enum class storage_policy : std::uint8_t {
+    sparse_set,
+    table
+};
+
+/**
+ * @brief Where a type of component is stored.
+ *
+ * Components live in their own sparse set by default. A component could declare
+ * `constexpr static auto storage_policy_v = storage_policy::table;` to be stored in archetype
+ * tables, so that iterating several table components together is a linear walk over columns.
+ */
+template <typename Component>
+struct storage_policy_of : std::integral_constant<storage_policy, storage_policy::sparse_set> {};
+
+template <typename Component>
+requires requires { Component::storage_policy_v; }
+struct storage_policy_of<Component> :
+    std::integral_constant<storage_policy, Component::storage_policy_v> {};
+
+template <typename Component>
+constexpr bool is_table_component_v =
+    storage_policy_of<Component>::value == storage_policy::table;
+
+/**
+ * @brief Operations a column needs to manage a type of component without knowing it.
+ *
+ */
+struct column_traits {
+    std::size_t size;
+    std::size_t align;
+    bool trivial;
+    // move construct at dst, then destroy src.
+    void (*relocate)(void* dst, void* src) noexcept;
+    void (*destroy)(void* ptr) noexcept;
+    std::pmr::memory_resource* (*resource)();
+
+    template <typename Component>
+    [[nodiscard]] static auto of() noexcept -> const column_traits* {
+        static_assert(std::is_nothrow_move_constructible_v<Component>);
+        constexpr static column_traits traits{
+            sizeof(Component),
+            alignof(Component),
+            std::is_trivially_copyable_v<Component>,
+            [](void* dst, void* src) noexcept {
+                auto* ptr = static_cast<Component*>(src);
+                ::new (dst) Component(std::move(*ptr));
+                std::destroy_at(ptr);
+            },
+            [](void* ptr) noexcept { std::destroy_at(static_cast<Component*>(ptr)); },
+            &component_resource<Component>
+        };
+        return &traits;
+    }
+};
+
+/**
+ * @brief Contiguous array of one type of component in an archetype, and their change ticks.
+ *
+ */
+class column {
+public:
+    explicit column(const column_traits* traits) noexcept : traits_(traits) {}
+    column(const column&) = delete;
+    column(column&& that) noexcept
+        : traits_(that.traits_), data_(std::exchange(that.data_, nullptr)),
+          ticks_(std::move(that.ticks_)), size_(std::exchange(that.size_, 0)),
+          capacity_(std::exchange(that.capacity_, 0)) {}
+    column& operator=(const column&) = delete;
+    column& operator=(column&&)      = delete;
+    ~column() {
+        clear();
+        deallocate(data_, capacity_);
+    }
+
+    [[nodiscard]] auto traits() const noexcept -> const column_traits* { return traits_; }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return size_; }
+
+    [[nodiscard]] auto at(const std::size_t row) const noexcept -> void* {
+        return data_ + row * traits_->size;
+    }
+
+    template <typename Component>
+    [[nodiscard]] auto data() const noexcept -> Component* {
+        return std::launder(reinterpret_cast<Component*>(data_));
+    }
+
+    [[nodiscard]] auto ticks() const noexcept -> component_ticks* { return ticks_.get(); }
+
+    /**
+     * @brief Append an uninitialized slot, the caller must construct an object in it.
+     *
+     * Its ticks are zero.
+     */
+    auto push() -> void* {
+        if (size_ == capacity_) [[unlikely]] {
+            reserve(capacity_ ? capacity_ << 1 : initial_capacity);
+        }
+        ticks_[size_] = {};
+        return at(size_++);
+    }
+
+    /**
+     * @brief Append `count` uninitialized slots, the caller must construct objects in them.
+     *
+     * @return The first of them.
+     */
+    auto grow(const std::size_t count) -> void* {
+        make_room(count);
+        std::fill_n(ticks_.get() + size_, count, component_ticks{});
+        const auto first = size_;
+        size_ += count;
+        return at(first);
+    }
+
+    /**
+     * @brief Make room for `count` more objects, growing by at least twice the capacity.
+     *
+     * Then pushing them doesn't allocate, so it can't throw.
+     */
+    void make_room(const std::size_t count) {
+        if (size_ + count > capacity_) {
+            reserve(std::max(size_ + count, capacity_ << 1));
+        }
+    }
+
+    /**
+     * @brief Fill a vacated row with the last object and shrink.
+     *
+     * The object in the row must have been relocated or destroyed before.
+     */
+    void fill(const std::size_t row) noexcept {
+        if (const auto last = size_ - 1; row != last) {
+            relocate(at(row), at(last));
+            ticks_[row] = ticks_[last];
+        }
+        --size_;
+    }
+
+    void reserve(const std::size_t capacity) {
+        if (capacity <= capacity_) {
+            return;
+        }
+
+        // both allocations come before the objects are relocated, so a throw changes nothing.
+        auto ticks = std::make_unique_for_overwrite<component_ticks[]>(capacity);
+        auto* data = static_cast<std::byte*>(
+            traits_->resource()->allocate(capacity * traits_->size, traits_->align)
+        );
+        if (traits_->trivial) {
+            if (size_) {
+                std::memcpy(data, data_, size_ * traits_->size);
+            }
+        }
+        else {
+            for (std::size_t i = 0; i < size_; ++i) {
+                traits_->relocate(data + i * traits_->size, at(i));
+            }
+        }
+        deallocate(data_, capacity_);
+        data_ = data;
+
+        std::copy_n(ticks_.get(), size_, ticks.get());
+        ticks_    = std::move(ticks);
+        capacity_ = capacity;
+    }
+
+    void clear() noexcept {
+        if (!traits_->trivial) {
+            for (std::size_t i = 0; i < size_; ++i) {
+                traits_->destroy(at(i));
+            }
+        }
+        size_ = 0;
+    }
+
+    void relocate(void* dst, void* src) const noexcept {
+        if (traits_->trivial) {
+            std::memcpy(dst, src, traits_->size);
+        }
+        else {
+            traits_->relocate(dst, src);
+        }
+    }
+
+private:
+    constexpr static std::size_t initial_capacity = 16;
+
+    void deallocate(std::byte* data, const std::size_t capacity) const noexcept {
+        if (data) {
+            traits_->resource()->deallocate(data, capacity * traits_->size, traits_->align);
+        }
+    }
+
+    const column_traits* traits_;
+    std::byte* data_{};
+    std::unique_ptr<component_ticks[]> ticks_;
+    std::size_t size_{};
+    std::size_t capacity_{};
+};
+
+/**
+ * @brief A table of all the entities that have exactly the same set of table components.
+ *
+ */
+class archetype {
+    friend class archetype_storage;
+
+public:
+    constexpr static std::uint32_t npos = (std::numeric_limits<std::uint32_t>::max)();
+
+    archetype(vector<component::id_t> components, const vector<const column_traits*>& traits)
+        : components_(std::move(components)) {
+        columns_.reserve(traits.size());
+        for (std::size_t i = 0; i < components_.size(); ++i) {
+            const auto id = components_[i];
+            columns_.emplace_back(traits[i]);
+            if (id >= column_index_.size()) {
+                column_index_.resize(id + 1, npos);
+            }
+            column_index_[id] = static_cast<std::uint32_t>(i);
+        }
+    }
+
+    archetype(const archetype&)            = delete;
+    archetype(archetype&&)                 = delete;
+    archetype& operator=(const archetype&) = delete;
+    archetype& operator=(archetype&&)      = delete;
+    ~archetype()                           = default;
+
+    /**
+     * @brief Component ids of this archetype, in ascending order.
+     *
+     */
+    [[nodiscard]] auto components() const noexcept -> const vector<component::id_t>& {
+        return components_;
+    }
+
+    [[nodiscard]] auto entities() const noexcept -> const vector<entity::id_t>& {
+        return entities_;
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return entities_.size(); }
+
+    [[nodiscard]] auto contains(const component::id_t id) const noexcept -> bool {
+        return id < column_index_.size() && column_index_[id] != npos;
+    }
+
+    [[nodiscard]] auto find(const component::id_t id) noexcept -> column* {
+        return contains(id) ? &columns_[column_index_[id]] : nullptr;
+    }
+
+    [[nodiscard]] auto find(const component::id_t id) const noexcept -> const column* {
+        return contains(id) ? &columns_[column_index_[id]] : nullptr;
+    }
+
+    [[nodiscard]] auto columns() noexcept -> vector<column>& { return columns_; }
+
+private:
+    /**
+     * @brief Remove a row whose objects have been relocated or destroyed.
+     *
+     * @return The entity moved into this row, or `0` if it was the last row.
+     */
+    auto remove_row(const std::uint32_t row) noexcept -> entity::id_t {
+        for (auto& column : columns_) {
+            column.fill(row);
+        }
+
+        const auto last = entities_.size() - 1;
+        entity::id_t moved{};
+        if (row != last) {
+            moved          = entities_[last];
+            entities_[row] = moved;
+        }
+        entities_.pop_back();
+        return moved;
+    }
+
+    vector<component::id_t> components_;
+    vector<column> columns_;
+    vector<std::uint32_t> column_index_;
+    vector<entity::id_t> entities_;
+    // cached transitions of the archetype graph
+    dense_map<component::id_t, archetype*> add_edges_;
+    dense_map<component::id_t, archetype*> remove_edges_;
+};
+
+/**
+ * @brief Archetype tables of a world, and where each entity lives in them.
+ *
+ * Entities without any table component are not in any table.
+ */
+class archetype_storage {
+public:
+    struct location {
+        archetype* table;
+        std::uint32_t row;
+    };
+
+    archetype_storage() { root_ = assure(vector<component::id_t>{}, {}); }
+
+    archetype_storage(const archetype_storage&)            = delete;
+    archetype_storage(archetype_storage&&)                 = delete;
+    archetype_storage& operator=(const archetype_storage&) = delete;
+    archetype_storage& operator=(archetype_storage&&)      = delete;
+    ~archetype_storage()                                   = default;
+
+    [[nodiscard]] auto archetypes() const noexcept -> const vector<std::unique_ptr<archetype>>& {
+        return archetypes_;
+    }
+
+    [[nodiscard]] auto locate(const entity::index_t index) const noexcept -> location {
+        return index < locations_.size() ? locations_[index] : location{};
+    }
+
+    [[nodiscard]] auto contains(const entity::index_t index, const component::id_t id)
+        const noexcept -> bool {
+        const auto [table, row] = locate(index);
+        return table && table->contains(id);
+    }
+
+    template <typename Component>
+    [[nodiscard]] auto find(const entity::index_t index, const component::id_t id) const noexcept
+        -> Component* {
+        if (const auto [table, row] = locate(index); table) [[likely]] {
+            if (const auto* column = table->find(id)) [[likely]] {
+                return column->data<Component>() + row;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Change ticks of a table component of an entity.
+     *
+     * @return `nullptr` if the entity doesn't have it.
+     */
+    [[nodiscard]] auto ticks_of(const entity::index_t index, const component::id_t id)
+        const noexcept -> component_ticks* {
+        if (const auto [table, row] = locate(index); table) [[likely]] {
+            if (const auto* column = table->find(id)) [[likely]] {
+                return column->ticks() + row;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Add a component to an entity, moving the entity to the next archetype.
+     *
+     * If the entity already has this component, the existing one will be returned untouched.
+     */
+    template <typename Component, typename... Args>
+    auto emplace(const entity::id_t entity, const component::id_t id, Args&&... args)
+        -> Component& {
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        if (auto* component = find<Component>(index, id)) [[unlikely]] {
+            return *component;
+        }
+
+        // construct before moving anything, so a throwing constructor leaves tables untouched. The
+        // move into the new row must not throw, that row would be left without an object.
+        static_assert(std::is_nothrow_move_constructible_v<Component>);
+        Component value(std::forward<Args>(args)...);
+
+        auto* from = locate(index).table;
+        auto* to   = transit_add(from ? from : root_, id, column_traits::of<Component>());
+        const auto row = move(entity, index, to);
+
+        auto* ptr = ::new (to->find(id)->at(row)) Component(std::move(value));
+        return *std::launder(ptr);
+    }
+
+    /**
+     * @brief Remove a component from an entity, moving the entity to the previous archetype.
+     *
+     */
+    void erase(const entity::index_t index, const component::id_t id) {
+        const auto [from, row] = locate(index);
+        if (!from || !from->contains(id)) {
+            return;
+        }
+
+        auto* to = transit_remove(from, id);
+        if (to == root_) {
+            erase(index);
+            return;
+        }
+
+        // the component is only destroyed once moving the rest can't throw any more.
+        reserve(to, 1);
+        auto* column = from->find(id);
+        column->traits()->destroy(column->at(row));
+        move(from->entities_[row], index, to);
+    }
+
+    /**
+     * @brief Remove an entity and all its table components.
+     *
+     */
+    void erase(const entity::index_t index) noexcept {
+        const auto [table, row] = locate(index);
+        if (!table) {
+            return;
+        }
+
+        for (auto& column : table->columns_) {
+            column.traits()->destroy(column.at(row));
+        }
+        detach_row(table, row);
+        locations_[index] = {};
+    }
+
+    /**
+     * @brief Archetype of the entities that have exactly the table components among these.
+     *
+     * Components that are not table components are skipped.
+     */
+    template <typename... Components>
+    auto archetype_of() -> archetype* {
+        archetype* table = root_;
+        const auto add   = [this, &table]<typename Component>() {
+            if constexpr (is_table_component_v<Component>) {
+                const auto id = component_index<Component>();
+                table         = transit_add(table, id, column_traits::of<Component>());
+            }
+        };
+        (add.template operator()<Components>(), ...);
+        return table;
+    }
+
+    /**
+     * @brief Archetype of a set of table components known by their traits, e.g. from a snapshot.
+     *
+     * @param components Ids of the components, in any order, paired with `traits`.
+     */
+    auto archetype_of(
+        const std::span<const component::id_t> components,
+        const std::span<const column_traits* const> traits
+    ) -> archetype* {
+        archetype* table = root_;
+        for (std::size_t i = 0; i < components.size(); ++i) {
+            table = transit_add(table, components[i], traits[i]);
+        }
+        return table;
+    }
+
+    /**
+     * @brief Put entities that are in no table at the end of an archetype.
+     *
+     * Their components are left uninitialized, the caller must construct them.
+     *
+     * @return Row of the first of them.
+     */
+    auto append(archetype* table, const std::span<const entity::id_t> entities) -> std::uint32_t {
+        const auto first = static_cast<std::uint32_t>(table->size());
+        table->entities_.insert(table->entities_.end(), entities.begin(), entities.end());
+        for (auto& column : table->columns_) {
+            column.grow(entities.size());
+        }
+
+        for (std::size_t i = 0; i < entities.size(); ++i) {
+            const auto index = static_cast<entity::index_t>(entities[i] >> magic_32);
+            if (index >= locations_.size()) {
+                locations_.resize(static_cast<std::size_t>(index) + 1);
+            }
+            locations_[index] = { table, first + static_cast<std::uint32_t>(i) };
+        }
+        return first;
+    }
+
+    /**
+     * @brief Make room for `count` more rows in an archetype.
+     *
+     * Then moving that many entities into it doesn't allocate, so it can't throw.
+     */
+    void reserve(archetype* table, const std::size_t count) {
+        if (table == root_) {
+            return;
+        }
+
+        auto& entities = table->entities_;
+        if (entities.capacity() - entities.size() < count) {
+            entities.reserve(std::max(entities.size() + count, entities.capacity() * 2));
+        }
+        for (auto& column : table->columns_) {
+            column.make_room(count);
+        }
+    }
+
+    /**
+     * @brief Put an entity that is in no table into an archetype with all its table components.
+     *
+     * The table components are moved out of `values`, the others are left untouched.
+     *
+     * @param table Must be the result of `archetype_of<Components...>()`.
+     */
+    template <typename... Components>
+    void insert(const entity::id_t entity, archetype* table, std::tuple<Components...>& values) {
+        if (table == root_) {
+            return;
+        }
+
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        const auto row   = move(entity, index, table);
+        const auto construct = [table, row]<typename Component>(Component& value) {
+            if constexpr (is_table_component_v<Component>) {
+                // the row is there already, it would be left without an object.
+                static_assert(std::is_nothrow_move_constructible_v<Component>);
+                ::new (table->find(component_index<Component>())->at(row))
+                    Component(std::move(value));
+            }
+        };
+        std::apply([&construct](auto&... value) { (construct(value), ...); }, values);
+    }
+
+    void clear() noexcept {
+        for (auto& table : archetypes_) {
+            for (auto& column : table->columns_) {
+                column.clear();
+            }
+            table->entities_.clear();
+        }
+        locations_.clear();
+    }
+
+private:
+    /**
+     * @brief Move an entity into another archetype.
+     *
+     * Components that exist in both archetypes are relocated, a component only in the destination
+     * is left uninitialized, and a component only in the source must have been destroyed. If it
+     * throws, nothing has changed.
+     *
+     * @return Row of the entity in the destination archetype.
+     */
+    auto move(const entity::id_t entity, const entity::index_t index, archetype* to)
+        -> std::uint32_t {
+        if (index >= locations_.size()) {
+            locations_.resize(static_cast<std::size_t>(index) + 1);
+        }
+        // everything that allocates comes first, the rest can't throw.
+        reserve(to, 1);
+
+        const auto [from, from_row] = locations_[index];
+        const auto row              = static_cast<std::uint32_t>(to->entities_.size());
+        to->entities_.emplace_back(entity);
+        for (std::size_t i = 0; i < to->columns_.size(); ++i) {
+            auto& column = to->columns_[i];
+            void* dst    = column.push();
+            if (from) {
+                if (auto* src = from->find(to->components_[i])) {
+                    column.relocate(dst, src->at(from_row));
+                    column.ticks()[row] = src->ticks()[from_row];
+                }
+            }
+        }
+
+        if (from) {
+            detach_row(from, from_row);
+        }
+        locations_[index] = { to, row };
+        return row;
+    }
+
+    void detach_row(archetype* table, const std::uint32_t row) noexcept {
+        if (const auto moved = table->remove_row(row)) {
+            locations_[static_cast<entity::index_t>(moved >> magic_32)].row = row;
+        }
+    }
+
+    auto transit_add(archetype* from, const component::id_t id, const column_traits* traits)
+        -> archetype* {
+        if (auto iter = from->add_edges_.find(id); iter != from->add_edges_.end()) [[likely]] {
+            return iter->second;
+        }
+
+        vector<component::id_t> components = from->components_;
+        vector<const column_traits*> traits_list;
+        const auto pos = std::lower_bound(components.begin(), components.end(), id);
+        const auto offset = pos - components.begin();
+        components.insert(pos, id);
+        traits_list.reserve(components.size());
+        for (const auto& column : from->columns_) {
+            traits_list.emplace_back(column.traits());
+        }
+        traits_list.insert(traits_list.begin() + offset, traits);
+
+        auto* to = assure(std::move(components), traits_list);
+        from->add_edges_.emplace(id, to);
+        to->remove_edges_.emplace(id, from);
+        return to;
+    }
+
+    auto transit_remove(archetype* from, const component::id_t id) -> archetype* {
+        if (auto iter = from->remove_edges_.find(id); iter != from->remove_edges_.end())
+            [[likely]] {
+            return iter->second;
+        }
+
+        vector<component::id_t> components;
+        vector<const column_traits*> traits_list;
+        for (std::size_t i = 0; i < from->components_.size(); ++i) {
+            if (from->components_[i] != id) {
+                components.emplace_back(from->components_[i]);
+                traits_list.emplace_back(from->columns_[i].traits());
+            }
+        }
+
+        auto* to = assure(std::move(components), traits_list);
+        from->remove_edges_.emplace(id, to);
+        to->add_edges_.emplace(id, from);
+        return to;
+    }
+
+    auto assure(vector<component::id_t> components, const vector<const column_traits*>& traits)
+        -> archetype* {
+        if (auto iter = lookup_.find(components); iter != lookup_.end()) {
+            return iter->second;
+        }
+
+        auto& table =
+            archetypes_.emplace_back(std::make_unique<archetype>(components, traits));
+        lookup_.emplace(std::move(components), table.get());
+        return table.get();
+    }
+
+    archetype* root_;
+    vector<std::unique_ptr<archetype>> archetypes_;
+    map<vector<component::id_t>, archetype*> lookup_;
+    vector<location> locations_;
+};
+
+} // namespace atom::ecs
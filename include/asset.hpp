@@ -1,14 +1,27 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <auxiliary/singleton.hpp>
 #include <concepts/type.hpp>
 #include <core/langdef.hpp>
 #include <reflection.hpp>
+#include "asset_load.hpp"
+#include "asset_pack.hpp"
 #include "containers.hpp"
 #include "ecs.hpp"
-#include "thread/coroutine.hpp"
+#include "handle_table.hpp"
 
 namespace atom::ecs {
 
@@ -40,6 +53,19 @@ struct proxy {
 template <typename Asset>
 using proxy_t = typename proxy<Asset>::type;
 
+/**
+ * @brief Makes the proxy of an asset from its key, e.g. reads and decodes a file.
+ *
+ * By default it calls `Asset::load(key)`, specialize it for assets without one. It is called on
+ * `scheduler::thread_pool()` by `hub::load_async`.
+ */
+template <typename Asset>
+struct asset_loader {
+    [[nodiscard]] auto operator()(const typename Asset::key_type& key) const -> proxy_t<Asset> {
+        return Asset::load(key);
+    }
+};
+
 class basic_library {
 public:
     basic_library()                                = default;
@@ -50,12 +76,17 @@ public:
     virtual ~basic_library()                       = default;
 };
 
+/**
+ * @brief Assets of a type, reached through handles.
+ *
+ * Reading is lock-free, see `handle_table`.
+ */
 template <typename Asset>
 class library : public basic_library {
 public:
     using proxy_type = proxy_t<Asset>;
 
-    library() : mutex_(), generator_(generate()), assets_() {}
+    library()                          = default;
     library(const library&)            = delete;
     library(library&&)                 = delete;
     library& operator=(const library&) = delete;
@@ -63,61 +94,49 @@ public:
     ~library() override                = default;
 
     auto install(proxy_t<Asset>&& proxy) -> std::pair<resource_handle, shared_ptr<proxy_t<Asset>>> {
-        auto handle    = generator_.get();
         auto proxy_ptr = std::make_shared<proxy_type>(std::move(proxy));
-        std::unique_lock<std::shared_mutex> ulock(mutex_);
-        assets_.emplace(handle, proxy_ptr);
-        ulock.unlock();
-        return std::make_pair(handle, proxy_ptr);
+        return std::make_pair(assets_.insert(proxy_ptr), proxy_ptr);
     }
 
     auto install(const shared_ptr<proxy_t<Asset>>& proxy) -> resource_handle {
-        auto handle = generator_.get();
-        std::unique_lock<std::shared_mutex> ulock(mutex_);
-        assets_.emplace(handle, proxy);
-        ulock.unlock();
-        return handle;
+        return assets_.insert(proxy);
     }
 
     auto install(shared_ptr<proxy_t<Asset>>&& proxy) -> resource_handle {
-        auto handle = generator_.get();
-        std::unique_lock<std::shared_mutex> ulock(mutex_);
-        assets_.emplace(handle, std::move(proxy));
-        ulock.unlock();
-        return handle;
+        return assets_.insert(std::move(proxy));
     }
 
-    [[nodiscard]] bool contains(const resource_handle handle) noexcept {
-        if (!handle) {
-            return false;
-        }
-
-        std::shared_lock<std::shared_mutex> slock(mutex_);
+    [[nodiscard]] bool contains(const resource_handle handle) const noexcept {
         return assets_.contains(handle);
     }
 
-    [[nodiscard]] auto fetch(const resource_handle handle) noexcept -> shared_ptr<proxy_t<Asset>> {
-        std::shared_lock<std::shared_mutex> slock(mutex_);
-        return assets_.at(handle);
+    /**
+     * @brief Asset of a handle.
+     *
+     * @return `nullptr` if the asset is uninstalled.
+     */
+    [[nodiscard]] auto fetch(const resource_handle handle) const noexcept
+        -> shared_ptr<proxy_t<Asset>> {
+        return assets_.fetch(handle);
     }
 
-    auto uninstall(const resource_handle handle) noexcept {
-        std::unique_lock<std::shared_mutex> ulock(mutex_);
-        assets_.erase(handle);
+    /**
+     * @brief Publish the proxy of a handle in place of `expected`, e.g. a placeholder.
+     *
+     * @return False if the asset was uninstalled or replaced meanwhile.
+     */
+    auto replace(
+        const resource_handle handle,
+        const shared_ptr<proxy_t<Asset>>& expected,
+        shared_ptr<proxy_t<Asset>> proxy
+    ) noexcept -> bool {
+        return assets_.replace(handle, expected, std::move(proxy));
     }
 
-private:
-    [[nodiscard]] static utils::thread_safe_coroutine<resource_handle> generate() noexcept {
-        resource_handle current{};
-        while (true) {
-            // NOTE: start from 1, which means 0 is invaild.
-            co_yield ++current;
-        }
-    }
+    auto uninstall(const resource_handle handle) noexcept { assets_.erase(handle); }
 
-    std::shared_mutex mutex_;
-    utils::thread_safe_coroutine<resource_handle> generator_;
-    map<resource_handle, shared_ptr<proxy_t<Asset>>> assets_;
+private:
+    handle_table<proxy_t<Asset>> assets_;
 };
 
 class basic_table {
@@ -130,21 +149,58 @@ public:
     virtual ~basic_table()                     = default;
 };
 
+/**
+ * @brief Deduplicating map from keys of assets, e.g. paths, to their handles.
+ *
+ * Entries are spread over shards by the hash of the key, each shard has a lock of its own that is
+ * only held to find, add or remove an entry. Each entry counts its users. `acquire` loads the
+ * asset of a key once, threads that ask for the same key meanwhile wait for that load.
+ */
 template <typename Asset>
 class table : public basic_table {
 public:
-    table() : mutex_(), mapping_() {}
+    using key_type = typename Asset::key_type;
+
+    table()                        = default;
     table(const table&)            = delete;
     table(table&&)                 = delete;
     table& operator=(const table&) = delete;
     table& operator=(table&&)      = delete;
     ~table() override              = default;
 
-    using key_type = typename Asset::key_type;
+    [[nodiscard]] bool contains(const key_type& key) const {
+        auto& shard = shard_of(key);
+        std::lock_guard guard{ shard.mutex };
+        return shard.entries.contains(key);
+    }
+
+    /**
+     * @brief Handle of a key, loading it if it is not in the table yet. Counter inc.
+     *
+     * The loader is called at most once at a time for a key. If it throws, the exception is
+     * rethrown in every thread that waited for it and the key is not added.
+     *
+     * @param loader Invocable with no arguments that installs the asset and returns its handle.
+     */
+    template <typename Loader>
+    auto acquire(const key_type& key, Loader&& loader) -> resource_handle {
+        return acquire_entry(key, std::forward<Loader>(loader), false).first;
+    }
 
-    bool contains(const key_type& key) noexcept {
-        std::shared_lock<std::shared_mutex> slock(mutex_);
-        return mapping_.contains(key);
+    /**
+     * @brief Handle of a key, loading it in the background if it is not in the table yet.
+     * Counter inc.
+     *
+     * Callers of the same key share the status of the load, keys added by `acquire` or `emplace`
+     * have no status, they are loaded already.
+     *
+     * @param start Invocable with the status of the load, which installs a placeholder, starts the
+     * load that finishes the status, and returns the handle.
+     */
+    template <typename Starter>
+    auto acquire_async(const key_type& key, Starter&& start)
+        -> std::pair<resource_handle, std::shared_ptr<internal::load_status>> {
+        return acquire_entry(key, std::forward<Starter>(start), true);
     }
 
     /**
@@ -152,67 +208,168 @@ public:
      * If the key is already exists, its counter will increase by 1.
      *
      */
-    void emplace(const key_type& key, const resource_handle handle) noexcept {
-        std::unique_lock<std::shared_mutex> ulock(mutex_);
-        if (auto iter = mapping_.find(key); iter != mapping_.end()) {
-            ++(iter->second.second);
+    void emplace(const key_type& key, const resource_handle handle) {
+        auto& shard = shard_of(key);
+        std::lock_guard guard{ shard.mutex };
+        if (auto iter = shard.entries.find(key); iter != shard.entries.end()) {
+            iter->second->count.fetch_add(1, std::memory_order_relaxed);
         }
         else {
-            mapping_.emplace(key, std::pair<resource_handle, uint32_t>(handle, 1));
+            std::promise<resource_handle> promise;
+            promise.set_value(handle);
+            shard.entries.emplace(key, std::make_unique<entry>(1, promise.get_future().share()));
         }
     }
 
-    resource_handle at(const key_type& key) noexcept {
-        std::shared_lock<std::shared_mutex> slock(mutex_);
-        return mapping_.at(key).first;
+    /**
+     * @brief Handle of a key, waits if it is being loaded.
+     *
+     */
+    [[nodiscard]] resource_handle at(const key_type& key) const {
+        auto& shard = shard_of(key);
+        std::shared_future<resource_handle> future;
+        {
+            std::lock_guard guard{ shard.mutex };
+            auto iter = shard.entries.find(key);
+            if (iter == shard.entries.end()) [[unlikely]] {
+                throw std::runtime_error("Couldn't find the asset of the key!");
+            }
+            future = iter->second->handle;
+        }
+        return future.get();
     }
 
-    uint32_t count(const key_type& key) noexcept {
-        std::shared_lock<std::shared_mutex> slock(mutex_);
-        return mapping_.at(key).second;
+    /**
+     * @brief Number of users of a key, zero if it is not in the table.
+     *
+     */
+    [[nodiscard]] uint32_t count(const key_type& key) const {
+        auto& shard = shard_of(key);
+        std::lock_guard guard{ shard.mutex };
+        auto iter = shard.entries.find(key);
+        return iter != shard.entries.end() ? iter->second->count.load(std::memory_order_relaxed)
+                                           : 0;
     }
 
     /**
      * @brief Erase a pair in table.
      * Counter dec.
      */
-    void erase(const key_type& key) noexcept {
-        std::shared_lock<std::shared_mutex> slock(mutex_);
-        if (auto iter = mapping_.find(key); iter != mapping_.end()) [[likely]] {
-            auto& [handle, count] = iter->second;
-            slock.unlock();
-            std::unique_lock<std::shared_mutex> ulock(mutex_);
-            --count;
-            if (!count) {
-                mapping_.erase(iter);
-            }
-        }
-    }
+    void erase(const key_type& key) { release(key); }
 
     /**
-     * @brief Erase a pair in table.
+     * @brief Erase a pair in table, and uninstall the asset when the last user is gone.
      * Counter dec.
      */
-    void erase(library<Asset>& library, const key_type& key) noexcept {
-        std::shared_lock<std::shared_mutex> slock(mutex_);
-        if (auto iter = mapping_.find(key); iter != mapping_.end()) [[likely]] {
-            auto& [handle, count] = iter->second;
-            slock.unlock();
-            std::unique_lock<std::shared_mutex> ulock(mutex_);
-            --count;
-            if (!count) {
-                ulock.unlock();
-                library.uninstall(handle);
-                ulock.lock();
-
-                mapping_.erase(iter);
-            }
+    void erase(library<Asset>& library, const key_type& key) {
+        if (const auto handle = release(key)) {
+            library.uninstall(handle);
         }
     }
 
 private:
-    std::shared_mutex mutex_;
-    map<typename Asset::key_type, std::pair<resource_handle, uint32_t>> mapping_;
+    struct entry {
+        entry(
+            const uint32_t count,
+            std::shared_future<resource_handle> handle,
+            std::shared_ptr<internal::load_status> status = nullptr
+        )
+            : count(count), handle(std::move(handle)), status(std::move(status)) {}
+
+        std::atomic<uint32_t> count;
+        std::shared_future<resource_handle> handle;
+        std::shared_ptr<internal::load_status> status;
+    };
+
+    struct alignas(64) shard {
+        mutable std::mutex mutex;
+        unordered_map<key_type, std::unique_ptr<entry>> entries;
+    };
+
+    constexpr static std::size_t shard_count = 64;
+
+    [[nodiscard]] auto shard_of(const key_type& key) const -> shard& {
+        return shards_[std::hash<key_type>{}(key) % shard_count];
+    }
+
+    // find or add the entry of a key, the first caller runs the loader, the others wait for it.
+    template <typename Loader>
+    auto acquire_entry(const key_type& key, Loader&& loader, const bool async)
+        -> std::pair<resource_handle, std::shared_ptr<internal::load_status>> {
+        auto& shard = shard_of(key);
+        std::promise<resource_handle> promise;
+        std::shared_future<resource_handle> future;
+        std::shared_ptr<internal::load_status> status;
+        entry* loading = nullptr;
+        {
+            std::lock_guard guard{ shard.mutex };
+            if (auto iter = shard.entries.find(key); iter != shard.entries.end()) {
+                iter->second->count.fetch_add(1, std::memory_order_relaxed);
+                future = iter->second->handle;
+                status = iter->second->status;
+            }
+            else {
+                future = promise.get_future().share();
+                if (async) {
+                    status = std::make_shared<internal::load_status>();
+                }
+                loading = shard.entries.emplace(key, std::make_unique<entry>(1, future, status))
+                              .first->second.get();
+            }
+        }
+
+        if (loading) {
+            try {
+                if constexpr (std::is_invocable_v<Loader&>) {
+                    promise.set_value(loader());
+                }
+                else {
+                    promise.set_value(loader(status));
+                }
+            }
+            catch (...) {
+                {
+                    std::lock_guard guard{ shard.mutex };
+                    if (auto iter = shard.entries.find(key);
+                        iter != shard.entries.end() && iter->second.get() == loading) {
+                        shard.entries.erase(iter);
+                    }
+                }
+                promise.set_exception(std::current_exception());
+            }
+        }
+        return { future.get(), std::move(status) };
+    }
+
+    // decrease the counter, return the handle if this was the last user and it is loaded.
+    auto release(const key_type& key) -> resource_handle {
+        auto& shard = shard_of(key);
+        std::shared_future<resource_handle> future;
+        {
+            std::lock_guard guard{ shard.mutex };
+            auto iter = shard.entries.find(key);
+            if (iter == shard.entries.end()) [[unlikely]] {
+                return 0;
+            }
+            if (iter->second->count.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return 0;
+            }
+            future = std::move(iter->second->handle);
+            shard.entries.erase(iter);
+        }
+        // a load that fails or is still running leaves nothing to uninstall here.
+        if (future.wait_for(std::chrono::seconds{ 0 }) != std::future_status::ready) {
+            return 0;
+        }
+        try {
+            return future.get();
+        }
+        catch (...) {
+            return 0;
+        }
+    }
+
+    mutable shard shards_[shard_count];
 };
 
 class hub : public utils::singleton<hub> {
@@ -221,6 +378,7 @@ class hub : public utils::singleton<hub> {
 
     template <concepts::asset Asset, std::size_t hash = utils::hash_of<Asset>()>
     auto find_lib() -> std::unique_ptr<basic_library>& {
+        std::lock_guard guard{ mutex_ };
         if (auto iter = libs_.find(hash); iter != libs_.end()) [[likely]] {
             return iter->second;
         }
@@ -233,6 +391,7 @@ class hub : public utils::singleton<hub> {
 
     template <concepts::asset Asset, std::size_t hash = utils::hash_of<Asset>()>
     auto find_table() -> std::unique_ptr<basic_table>& {
+        std::lock_guard guard{ mutex_ };
         if (auto iter = tables_.find(hash); iter != tables_.end()) [[likely]] {
             return iter->second;
         }
@@ -248,22 +407,108 @@ public:
     template <concepts::asset Asset>
     [[nodiscard]] auto library() -> library<Asset>& {
         static_assert(utils::concepts::pure<Asset>);
-        std::unique_ptr<basic_library>& lib = find_lib<Asset>();
-        auto* ptr                           = lib.get();
-        return *static_cast<ecs::library<Asset>*>(ptr);
+        // the maps are only searched the first time, systems could ask for it in parallel.
+        static auto* const lib = static_cast<ecs::library<Asset>*>(find_lib<Asset>().get());
+        return *lib;
     }
 
     template <concepts::asset Asset>
     [[nodiscard]] auto table() -> table<Asset>& {
         static_assert(utils::concepts::pure<Asset>);
-        std::unique_ptr<basic_table>& tab = find_table<Asset>();
-        auto* ptr                         = tab.get();
-        return *static_cast<ecs::table<Asset>*>(ptr);
+        static auto* const tab = static_cast<ecs::table<Asset>*>(find_table<Asset>().get());
+        return *tab;
+    }
+
+    /**
+     * @brief Mount a pack, the assets in it are used before their loaders.
+     *
+     * Packs mounted later are searched first.
+     */
+    void mount(std::shared_ptr<const asset_pack> pack) {
+        std::unique_lock guard{ packs_mutex_ };
+        packs_.emplace(packs_.begin(), std::move(pack));
+    }
+
+    void unmount(const asset_pack* pack) {
+        std::unique_lock guard{ packs_mutex_ };
+        std::erase_if(packs_, [pack](const auto& mounted) { return mounted.get() == pack; });
+    }
+
+    /**
+     * @brief Blob of a key in the mounted packs.
+     *
+     * @return An empty blob if no pack has the key.
+     */
+    [[nodiscard]] auto find_blob(const std::string_view key) const -> asset_blob {
+        std::shared_lock guard{ packs_mutex_ };
+        for (const auto& pack : packs_) {
+            if (auto blob = pack->blob(key)) {
+                return blob;
+            }
+        }
+        return {};
+    }
+
+    /**
+     * @brief Handle of the asset of a key, loading it on `scheduler::thread_pool()` if it is not
+     * loaded yet.
+     *
+     * Returns at once. Until the load finishes the library holds a default constructed proxy for
+     * the handle, then the loaded one is published in its place. Callers of the same key share
+     * the load. If the loader throws, the load fails and the placeholder stays.
+     *
+     * If the proxy is constructible from an `asset_blob` and a mounted pack has the key, the proxy
+     * is made from the mapped bytes at once instead, see `asset_pack`.
+     *
+     * @param loader Invocable with the key that returns the proxy, see `asset_loader`.
+     */
+    template <concepts::asset Asset, typename Loader = asset_loader<Asset>>
+    auto load_async(const typename Asset::key_type& key, Loader loader = {}) -> asset_load<Asset> {
+        auto& library = this->library<Asset>();
+        auto [handle, status] = table<Asset>().acquire_async(
+            key,
+            [&](const std::shared_ptr<internal::load_status>& loading) {
+                if constexpr (std::is_constructible_v<proxy_t<Asset>, asset_blob>) {
+                    if (auto blob = find_blob(pack_key(key))) {
+                        auto installed = library.install(proxy_t<Asset>(std::move(blob))).first;
+                        loading->finish(load_state::ready);
+                        return installed;
+                    }
+                }
+                auto [installed, placeholder] = library.install(proxy_t<Asset>{});
+                load(library, installed, std::move(placeholder), key, std::move(loader), loading);
+                return installed;
+            }
+        );
+        return asset_load<Asset>{ handle, std::move(status) };
     }
 
 private:
-    // NOTE: when running for a while, we will not emplace or erase library, we need not to lock
-    // these containers.
+    template <typename Asset, typename Loader>
+    static auto load(
+        ecs::library<Asset>& library,
+        const resource_handle handle,
+        shared_ptr<proxy_t<Asset>> placeholder,
+        typename Asset::key_type key,
+        Loader loader,
+        std::shared_ptr<internal::load_status> status
+    ) -> internal::detached_task {
+        try {
+            co_await internal::resume_on_pool{};
+            auto proxy = std::make_shared<proxy_t<Asset>>(loader(std::as_const(key)));
+            const auto published = library.replace(handle, placeholder, std::move(proxy));
+            status->finish(published ? load_state::ready : load_state::failed);
+        }
+        catch (...) {
+            status->finish(load_state::failed);
+        }
+    }
+
+    // NOTE: when running for a while, we will not emplace or erase library, the lock is only
+    // taken the first time a type of asset is used.
+    std::mutex mutex_;
+    mutable std::shared_mutex packs_mutex_;
+    vector<std::shared_ptr<const asset_pack>> packs_;
     map<std::size_t, std::unique_ptr<basic_library>> libs_;
     map<std::size_t, std::unique_ptr<basic_table>> tables_;
 };
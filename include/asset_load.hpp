@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include "containers.hpp"
+#include "ecs.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief State of an asynchronous load of an asset.
+ *
+ */
+enum class load_state : std::uint8_t {
+    loading,
+    ready,
+    failed
+};
+
+namespace internal {
+
+/**
+ * @brief Shared state of a load, finished once by the loading coroutine.
+ *
+ */
+class load_status {
+public:
+    [[nodiscard]] auto state() const noexcept -> load_state {
+        return state_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Block until the load finishes.
+     *
+     */
+    void wait() const noexcept { state_.wait(load_state::loading, std::memory_order_acquire); }
+
+    /**
+     * @brief Resume a coroutine on the thread pool when the load finishes.
+     *
+     * @return False if the load has finished already, then the coroutine should go on.
+     */
+    auto suspend(std::coroutine_handle<> awaiting) -> bool;
+
+    void finish(load_state state);
+
+private:
+    std::atomic<load_state> state_{ load_state::loading };
+    std::mutex mutex_;
+    vector<std::coroutine_handle<>> awaiting_;
+};
+
+/**
+ * @brief Coroutine that starts at once and frees itself when it ends, nobody waits for it.
+ *
+ */
+struct detached_task {
+    struct promise_type {
+        [[nodiscard]] auto get_return_object() noexcept -> detached_task { return {}; }
+        [[nodiscard]] auto initial_suspend() const noexcept -> std::suspend_never { return {}; }
+        [[nodiscard]] auto final_suspend() const noexcept -> std::suspend_never { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+/**
+ * @brief Awaiter that moves the coroutine to `scheduler::thread_pool()`.
+ *
+ */
+struct resume_on_pool {
+    [[nodiscard]] auto await_ready() const noexcept -> bool { return false; }
+    void await_suspend(std::coroutine_handle<> handle) const;
+    void await_resume() const noexcept {}
+};
+
+} // namespace internal
+
+/**
+ * @brief Handle of an asset that is loaded in the background, see `hub::load_async`.
+ *
+ * The handle is valid at once, the library holds a placeholder proxy for it until the load
+ * finishes, then the loaded proxy. Poll `state()`, block in `wait()` or `co_await` it.
+ *
+ * @tparam Asset Asset type.
+ */
+template <typename Asset>
+class asset_load {
+public:
+    asset_load() noexcept = default;
+    asset_load(const resource_handle handle, std::shared_ptr<internal::load_status> status) noexcept
+        : handle_(handle), status_(std::move(status)) {}
+
+    [[nodiscard]] auto handle() const noexcept -> resource_handle { return handle_; }
+
+    /**
+     * @brief State of the load, assets that were loaded synchronously are always ready.
+     *
+     */
+    [[nodiscard]] auto state() const noexcept -> load_state {
+        return status_ ? status_->state() : load_state::ready;
+    }
+
+    [[nodiscard]] auto ready() const noexcept -> bool { return state() == load_state::ready; }
+
+    void wait() const noexcept {
+        if (status_) {
+            status_->wait();
+        }
+    }
+
+    /**
+     * @brief Wait for the load in a coroutine, which goes on on the thread pool.
+     *
+     * @return The state the load finished with.
+     */
+    [[nodiscard]] auto operator co_await() const noexcept {
+        struct awaiter {
+            [[nodiscard]] auto await_ready() const noexcept -> bool {
+                return !status || status->state() != load_state::loading;
+            }
+
+            auto await_suspend(std::coroutine_handle<> awaiting) const -> bool {
+                return status->suspend(awaiting);
+            }
+
+            [[nodiscard]] auto await_resume() const noexcept -> load_state {
+                return status ? status->state() : load_state::ready;
+            }
+
+            internal::load_status* status;
+        };
+
+        return awaiter{ status_.get() };
+    }
+
+private:
+    resource_handle handle_{};
+    std::shared_ptr<internal::load_status> status_;
+};
+
+} // namespace atom::ecs
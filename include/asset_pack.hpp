@@ -0,0 +1,209 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "containers.hpp"
+
+namespace atom::ecs {
+
+namespace internal {
+
+/**
+ * @brief Header at the start of a pack.
+ *
+ * A pack is the header, the table of contents, the keys and then the blobs, each blob starts at a
+ * multiple of `alignment`. Numbers are in the byte order of the machine that wrote the pack.
+ */
+struct pack_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t alignment;
+    std::uint64_t entry_count;
+    // a power of two, at least twice the number of entries.
+    std::uint64_t bucket_count;
+    std::uint64_t toc_offset;
+};
+
+/**
+ * @brief Bucket of the table of contents, open addressing with linear probing.
+ *
+ */
+struct pack_entry {
+    std::uint64_t hash;
+    // zero for an empty bucket, keys are never at the start of a pack.
+    std::uint64_t key_offset;
+    std::uint64_t key_size;
+    std::uint64_t blob_offset;
+    std::uint64_t blob_size;
+};
+
+constexpr char pack_magic[8]          = { 'A', 'T', 'O', 'M', 'P', 'A', 'C', 'K' };
+constexpr std::uint32_t pack_version  = 1;
+constexpr std::uint64_t pack_fnv_seed = 14695981039346656037ULL;
+
+/**
+ * @brief Hash of a key in the table of contents, FNV-1a, so it is the same in every build.
+ *
+ */
+[[nodiscard]] constexpr auto pack_hash(const std::string_view key) noexcept -> std::uint64_t {
+    auto hash = pack_fnv_seed;
+    for (const auto ch : key) {
+        hash ^= static_cast<unsigned char>(ch);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+} // namespace internal
+
+/**
+ * @brief Bytes of a key in a pack.
+ *
+ * Keys that convert to a string view, e.g. paths as `std::string`, are their characters, other
+ * keys must be trivially copyable and are their object representation.
+ */
+template <typename Key>
+[[nodiscard]] auto pack_key(const Key& key) noexcept -> std::string_view {
+    if constexpr (std::is_convertible_v<const Key&, std::string_view>) {
+        return key;
+    }
+    else {
+        static_assert(std::has_unique_object_representations_v<Key>);
+        return { reinterpret_cast<const char*>(&key), sizeof(Key) };
+    }
+}
+
+/**
+ * @brief Blob of an asset in a mounted pack, it keeps the pack mapped.
+ *
+ * Proxies that are constructible from a blob are made by pointing into the mapped pages, nothing
+ * is read or copied until they touch the bytes.
+ */
+struct asset_blob {
+    std::shared_ptr<const std::byte> data;
+    std::size_t size{};
+
+    [[nodiscard]] auto bytes() const noexcept -> std::span<const std::byte> {
+        return { data.get(), size };
+    }
+
+    [[nodiscard]] explicit operator bool() const noexcept { return data != nullptr; }
+};
+
+/**
+ * @brief Archive of assets mapped read-only into memory.
+ *
+ * Opening maps the file and checks its table of contents once, finding a key is a probe of that
+ * table. The page cache keeps the pages of a pack across processes. Thread safe.
+ */
+class asset_pack : public std::enable_shared_from_this<asset_pack> {
+public:
+    asset_pack(const asset_pack&)            = delete;
+    asset_pack(asset_pack&&)                 = delete;
+    asset_pack& operator=(const asset_pack&) = delete;
+    asset_pack& operator=(asset_pack&&)      = delete;
+
+    ~asset_pack() noexcept;
+
+    /**
+     * @brief Map a pack.
+     *
+     * @throw std::runtime_error If the file couldn't be mapped or is not a valid pack.
+     */
+    [[nodiscard]] static auto open(const std::filesystem::path& path)
+        -> std::shared_ptr<asset_pack>;
+
+    /**
+     * @brief Bytes of a key.
+     *
+     * @return An empty span if there is no such key.
+     */
+    [[nodiscard]] auto find(std::string_view key) const noexcept -> std::span<const std::byte>;
+
+    [[nodiscard]] auto contains(const std::string_view key) const noexcept -> bool {
+        return find(key).data() != nullptr;
+    }
+
+    /**
+     * @brief Blob of a key, it shares the ownership of the pack.
+     *
+     * @return An empty blob if there is no such key.
+     */
+    [[nodiscard]] auto blob(std::string_view key) const -> asset_blob;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return static_cast<std::size_t>(header()->entry_count);
+    }
+
+private:
+    asset_pack() noexcept = default;
+
+    [[nodiscard]] auto header() const noexcept -> const internal::pack_header* {
+        return reinterpret_cast<const internal::pack_header*>(data_);
+    }
+
+    // throws if the header or an entry points out of the file, or a blob is not aligned.
+    void validate() const;
+
+    const std::byte* data_{};
+    std::size_t size_{};
+    const internal::pack_entry* toc_{};
+    std::uint64_t mask_{};
+#if defined(_WIN32)
+    void* file_{};
+    void* mapping_{};
+#endif
+};
+
+/**
+ * @brief Builds packs, used by the packer tool.
+ *
+ */
+class asset_pack_writer {
+public:
+    /**
+     * @brief Blobs start at multiples of the alignment, a power of two.
+     *
+     */
+    explicit asset_pack_writer(std::uint32_t alignment = 64);
+
+    /**
+     * @brief Add the bytes of a key.
+     *
+     * @throw std::runtime_error If the key is empty or added already.
+     */
+    void add(std::string key, std::span<const std::byte> bytes);
+
+    /**
+     * @brief Add the content of a file as the bytes of a key.
+     *
+     */
+    void add_file(std::string key, const std::filesystem::path& path);
+
+    /**
+     * @brief Write the pack, replacing the file.
+     *
+     * The pack is written to `<path>.tmp` and renamed over the file, so processes that have the
+     * old pack mapped keep reading it.
+     */
+    void write(const std::filesystem::path& path) const;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return entries_.size(); }
+
+private:
+    struct entry {
+        std::string key;
+        vector<std::byte> bytes;
+    };
+
+    std::uint32_t alignment_;
+    vector<entry> entries_;
+    unordered_map<std::string, std::size_t> indices_;
+};
+
+} // namespace atom::ecs
@@ -1,27 +1,63 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <iterator>
 #include <ranges>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
 #include <core/langdef.hpp>
 #include <memory/pool.hpp>
-#include <memory/storage.hpp>
 #include <reflection.hpp>
+#include "archetype.hpp"
 #include "asset.hpp"
+#include "command_buffer.hpp"
 #include "core.hpp"
 #include "ecs.hpp"
 #include "memory.hpp"
 #include "memory/allocator.hpp"
+#include "resource_table.hpp"
 #include "schedule.hpp"
+#include "snapshot.hpp"
+#include "sparse_set.hpp"
 #include "world.hpp"
 
 namespace atom::ecs {
+/**
+ * @brief Change entities, components and resources of a world.
+ *
+ * In a non-exclusive system, see `system_access`, every change is recorded and applied at the
+ * next sync point, in the order it was made: spawning, killing, attaching, detaching and modifying
+ * components, adding, setting and removing resources. Until then the system sees the world as it
+ * was, e.g. `queryer::get` of a component attached in the same run throws. Ids of spawned
+ * entities are valid right away. Events are sent at once.
+ */
 class command {
 public:
     struct command_attorney;
     friend struct command_attorney;
 
-    command(ECS world& world) : world_(&world) {}
-    command(ECS world* world) : world_(world) {}
-    command(command&& other) noexcept : world_(std::exchange(other.world_, nullptr)) {}
+    /**
+     * @brief Command whose changes are stamped with a new tick of the world.
+     *
+     */
+    command(ECS world& world) : command(&world) {}
+    command(ECS world* world) : world_(world), tick_(world->advance_tick()) {}
+
+    /**
+     * @brief Command whose changes are stamped with the tick of a system run.
+     *
+     * @param deferred Whether the system is non-exclusive. Its changes must be made where it
+     * records them, otherwise they throw `std::logic_error`.
+     */
+    command(ECS world* world, const component::tick_t tick, const bool deferred = false)
+        : world_(world), tick_(tick), deferred_(deferred) {}
+
+    command(command&& other) noexcept
+        : world_(std::exchange(other.world_, nullptr)), tick_(other.tick_),
+          deferred_(other.deferred_) {}
     command(const command& other)      = default;
     command& operator=(const command&) = delete;
     command& operator=(command&&)      = delete;
@@ -32,119 +68,274 @@ public:
     ///////////////////////////////////////////////////////////////////////
 private:
     template <utils::concepts::pure RawComponentType>
-    void check_map_existance(default_id_t identity) {
-        if (!world_->component_storage_.contains(identity)) [[unlikely]] {
-            world_->component_storage_.emplace(
-                identity,
-                std::make_tuple(
-                    dense_map<entity::index_t, void*>(),
-                    new utils::allocator<RawComponentType, utils::synchronized_pool>(
-                        scheduler::synchronized_pool()
-                    ),
-                    new utils::reflected<RawComponentType>()
-                )
-            );
+    auto check_map_existance(const component::id_t identity) -> sparse_set<RawComponentType>* {
+        auto& storages = world_->component_storage_;
+        if (identity >= storages.size()) [[unlikely]] {
+            storages.resize(static_cast<std::size_t>(identity) + 1);
+        }
+
+        auto& [storage, reflected] = storages[identity];
+        if (!storage) [[unlikely]] {
+            storage   = new sparse_set<RawComponentType>();
+            reflected = new utils::reflected<RawComponentType>();
         }
+        return static_cast<sparse_set<RawComponentType>*>(storage);
     }
 
-    template <utils::concepts::pure Component, std::size_t hash = utils::hash_of<Component>()>
+    template <utils::concepts::pure Component>
     requires std::is_default_constructible_v<Component>
-    void attach_impl(const entity::index_t index) {
+    void attach_impl(const entity::id_t entity) {
         ATOM_DEBUG_SHOW_FUNC
 
-        const auto identity = component_registry::identity(hash);
-        check_map_existance<Component>(identity);
+        static_cast<void>(internal::snapshot_component_enrolled<Component>);
 
-        auto& [map, basic_allocator, reflected] = world_->component_storage_.at(identity);
-        if (!map.contains(index)) [[likely]] {
-            map.emplace(index, nullptr);
+        const auto identity = component_index<Component>();
+        const entity::index_t index = entity >> magic_32;
+        auto& signature             = world_->entities_.signature_of(index);
+        const bool added            = !signature.test(identity);
+        if constexpr (is_table_component_v<Component>) {
+            world_->archetypes_.emplace<Component>(entity, identity);
         }
+        else {
+            auto* storage = check_map_existance<Component>(identity);
+            storage->emplace(entity);
+        }
+        signature.set(identity);
+        if (added) {
+            *ticks_of<Component>(index, identity) = { tick_, tick_ };
+        }
+        refresh_queries(identity, entity);
     }
 
 public:
     template <utils::concepts::pure... Components>
     auto attach(const ECS entity::id_t entity) -> void {
-        const entity::index_t index = entity >> magic_32;
-        (attach_impl<Components>(index), ...);
+        if (auto* buffer = deferral()) [[unlikely]] {
+            buffer->push([world = world_, entity] {
+                replay(world).attach<Components...>(entity);
+            });
+            return;
+        }
+        (attach_impl<Components>(entity), ...);
     }
 
 private:
-    template <
-        utils::concepts::pure Component,
-        typename ComponentTy,
-        auto hash = utils::hash_of<Component>()>
-    void attach_impl(const entity::index_t index, ComponentTy&& value) {
+    template <utils::concepts::pure Component, typename ComponentTy>
+    void attach_impl(const entity::id_t entity, ComponentTy&& value) {
         ATOM_DEBUG_SHOW_FUNC
 
-        const auto identity = component_registry::identity(hash);
-        check_map_existance<Component>(identity);
+        static_cast<void>(internal::snapshot_component_enrolled<Component>);
 
-        auto& [map, basic_allocator, basic_reflected] = world_->component_storage_.at(identity);
-        if (!map.contains(index)) [[likely]] {
-            auto* allocator =
-                static_cast<utils::allocator<Component, utils::synchronized_pool>*>(basic_allocator
-                );
-            Component* ptr = allocator->allocate(1);
-            ::new (ptr) Component(std::forward<ComponentTy>(value));
-            map.emplace(index, std::launder(ptr));
+        const auto identity = component_index<Component>();
+        const entity::index_t index = entity >> magic_32;
+        auto& signature             = world_->entities_.signature_of(index);
+        const bool added            = !signature.test(identity);
+        if constexpr (is_table_component_v<Component>) {
+            world_->archetypes_.emplace<Component>(
+                entity, identity, std::forward<ComponentTy>(value)
+            );
         }
+        else {
+            auto* storage = check_map_existance<Component>(identity);
+            storage->emplace(entity, std::forward<ComponentTy>(value));
+        }
+        signature.set(identity);
+        if (added) {
+            *ticks_of<Component>(index, identity) = { tick_, tick_ };
+        }
+        refresh_queries(identity, entity);
     }
 
 public:
     template <utils::concepts::pure... Components, typename... ComponentTys>
     void attach(const entity::id_t entity, ComponentTys&&... components) {
-        const entity::index_t index = entity >> magic_32;
-        (attach_impl<Components>(index, std::forward<ComponentTys>(components)), ...);
+        if (auto* buffer = deferral()) [[unlikely]] {
+            auto record = [world = world_,
+                           entity,
+                           ... values = std::forward<ComponentTys>(components)]() mutable {
+                replay(world).attach<Components...>(entity, std::move(values)...);
+            };
+            buffer->push(std::move(record));
+            return;
+        }
+        (attach_impl<Components>(entity, std::forward<ComponentTys>(components)), ...);
     }
 
+    /**
+     * @brief Spawn an entity.
+     *
+     * In a deferred system the id is reserved now, the entity lives after the next sync point.
+     */
     auto spawn() -> ECS entity::id_t {
-        entity::index_t index{};
-        if (world_->free_indices_.size()) {
-            index = world_->free_indices_.back();
-            world_->free_indices_.pop_back();
-        }
-        else {
-            index = world_->generations_.size();
-            world_->generations_.emplace_back(0);
+        if (auto* buffer = deferral()) [[unlikely]] {
+            const auto entity = world_->entities_.reserve_id();
+            buffer->push([world = world_, entity] { replay(world).enter_queries(entity); });
+            return entity;
         }
 
-        entity::id_t entity = ((entity::id_t)index << magic_32) | world_->generations_[index];
-
-        world_->living_entities_.emplace(entity);
-
+        const auto entity = world_->entities_.emplace();
+        enter_queries(entity);
         return entity;
     }
 
     template <utils::concepts::pure... Components>
     requires std::conjunction_v<std::is_same<std::remove_cvref_t<Components>, Components>...>
     auto spawn() -> ECS entity::id_t {
-        auto entity                 = spawn();
-        const entity::index_t index = entity >> magic_32;
-        (attach_impl<Components>(index), ...);
+        auto entity = spawn();
+        attach<Components...>(entity);
         return entity;
     }
 
     template <utils::concepts::pure... Components, typename... ComponentTys>
     auto spawn(ComponentTys&&... components) -> entity::id_t {
-        auto entity                 = spawn();
-        const entity::index_t index = entity >> magic_32;
-        (attach_impl<Components>(index, std::forward<ComponentTys>(components)), ...);
+        auto entity = spawn();
+        attach<Components...>(entity, std::forward<ComponentTys>(components)...);
         return entity;
     }
 
 private:
-    template <
-        utils::concepts::pure Component,
-        typename ComponentTy,
-        auto hash = utils::hash_of<Component>()>
-    void modify_impl(const entity::index_t index, ComponentTy&& value) {
-        const auto identity = ecs::component_registry::identity(hash);
+    template <typename Component>
+    auto batch_storage(const std::size_t count) -> basic_sparse_set* {
+        static_cast<void>(internal::snapshot_component_enrolled<Component>);
+        if constexpr (is_table_component_v<Component>) {
+            return nullptr;
+        }
+        else {
+            auto* storage = check_map_existance<Component>(component_index<Component>());
+            storage->reserve(count);
+            return storage;
+        }
+    }
+
+    template <typename Component>
+    static void batch_emplace(basic_sparse_set* storage, entity::id_t entity, Component& value) {
+        if constexpr (!is_table_component_v<Component>) {
+            static_cast<sparse_set<Component>*>(storage)->emplace(entity, std::move(value));
+        }
+    }
+
+    /**
+     * @brief Spawn `count` entities, `next()` gives the components of each one in order.
+     *
+     * Storages are resolved and reserved once, then the entities are made in one loop.
+     */
+    template <typename... Components, typename Next>
+    auto spawn_batch(const std::size_t count, Next&& next) -> vector<entity::id_t> {
+        if (auto* buffer = deferral()) [[unlikely]] {
+            // the record only lives until the next sync point, its copies are in the frame arena.
+            auto* arena = world_->frame_arena();
+            vector<entity::id_t> entities;
+            vector<std::tuple<Components...>> values{ arena };
+            entities.reserve(count);
+            values.reserve(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                values.emplace_back(next());
+                entities.emplace_back(world_->entities_.reserve_id());
+            }
+
+            auto record = [world = world_,
+                           ids    = vector<entity::id_t>{ entities, arena },
+                           values = std::move(values)]() mutable {
+                auto value = values.begin();
+                auto id    = ids.begin();
+                replay(world).spawn_batch<Components...>(
+                    values.size(), [&value] { return std::move(*value++); }, [&id] { return *id++; }
+                );
+            };
+            buffer->push(std::move(record));
+            return entities;
+        }
+
+        auto& living = world_->entities_;
+        return spawn_batch<Components...>(count, std::forward<Next>(next), [&living] {
+            return living.emplace();
+        });
+    }
+
+    // `make()` gives the id of each entity, a new one or one reserved by a deferred system.
+    template <typename... Components, typename Next, typename Make>
+    auto spawn_batch(const std::size_t count, Next&& next, Make&& make) -> vector<entity::id_t> {
+        vector<entity::id_t> entities;
+        entities.reserve(count);
+        world_->entities_.reserve(count);
+
+        const std::array<basic_sparse_set*, sizeof...(Components)> storages{
+            batch_storage<Components>(count)...
+        };
+        auto* table = world_->archetypes_.template archetype_of<Components...>();
+        world_->archetypes_.reserve(table, count);
+        const auto mask = signature::of<Components...>();
+
+        for (std::size_t i = 0; i < count; ++i) {
+            std::tuple<Components...> values(next());
+            const auto entity = make();
+            [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+                (batch_emplace(storages[Is], entity, std::get<Is>(values)), ...);
+            }(std::index_sequence_for<Components...>{});
+            world_->archetypes_.insert(entity, table, values);
+            world_->entities_.signature_of(entity >> magic_32) = mask;
+            (stamp_added<Components>(entity >> magic_32), ...);
+
+            enter_queries(entity);
+            (refresh_queries(component_index<Components>(), entity), ...);
+            entities.emplace_back(entity);
+        }
+        return entities;
+    }
+
+public:
+    /**
+     * @brief Spawn `count` entities with default constructed components.
+     *
+     * @return Ids of the new entities.
+     */
+    template <utils::concepts::pure... Components>
+    auto spawn_n(const std::size_t count) -> vector<entity::id_t> {
+        return spawn_batch<Components...>(count, [] { return std::tuple<Components...>{}; });
+    }
+
+    /**
+     * @brief Spawn `count` entities, whose components are made by `init`.
+     *
+     * @param init Invocable with the position in the batch, returns the component, or a tuple of
+     * the components when there are several.
+     * @return Ids of the new entities.
+     */
+    template <utils::concepts::pure... Components, std::invocable<std::size_t> Init>
+    auto spawn_n(const std::size_t count, Init&& init) -> vector<entity::id_t> {
+        std::size_t i{};
+        return spawn_batch<Components...>(count, [&init, &i] { return init(i++); });
+    }
+
+    /**
+     * @brief Spawn an entity for each element of a range.
+     *
+     * @param values Components of each entity, a tuple of them when there are several.
+     * @return Ids of the new entities.
+     */
+    template <utils::concepts::pure... Components, std::ranges::forward_range Rng>
+    requires(!std::invocable<Rng, std::size_t>)
+    auto spawn_n(Rng&& values) -> vector<entity::id_t> {
+        const auto count = static_cast<std::size_t>(std::ranges::distance(values));
+        auto iter        = std::ranges::begin(values);
+        return spawn_batch<Components...>(count, [&iter]() -> decltype(auto) { return *iter++; });
+    }
 
-        if (auto iter = world_->component_storage_.find(identity);
-            iter != world_->component_storage_.cend()) [[likely]] {
-            auto& [map, allocator, reflected] = iter->second;
-            if (auto iterator = map.find(index); iterator != map.cend()) [[likely]] {
-                (*static_cast<Component*>(iterator->second)) = std::forward<ComponentTy>(value);
+private:
+    template <utils::concepts::pure Component, typename ComponentTy>
+    void modify_impl(const entity::index_t index, ComponentTy&& value) {
+        const auto identity = component_index<Component>();
+        if constexpr (is_table_component_v<Component>) {
+            if (auto* component = world_->archetypes_.find<Component>(index, identity))
+                [[likely]] {
+                *component = std::forward<ComponentTy>(value);
+                world_->archetypes_.ticks_of(index, identity)->changed = tick_;
+            }
+        }
+        else if (auto* storage = world_->storage_of<Component>()) [[likely]] {
+            if (auto* component = storage->find(index)) [[likely]] {
+                *component = std::forward<ComponentTy>(value);
+                storage->ticks_of(index)->changed = tick_;
             }
         }
     }
@@ -152,74 +343,113 @@ private:
 public:
     template <typename... Components>
     auto modify(const ECS entity::id_t entity, Components&&... components) -> void {
+        if (auto* buffer = deferral()) [[unlikely]] {
+            auto record = [world = world_,
+                           entity,
+                           ... values = std::forward<Components>(components)]() mutable {
+                replay(world).modify(entity, std::move(values)...);
+            };
+            buffer->push(std::move(record));
+            return;
+        }
+
         const entity::index_t index = entity >> magic_32;
-        (modify_impl<Components>(index, std::forward<Components>(components)), ...);
+        (modify_impl<std::remove_cvref_t<Components>>(index, std::forward<Components>(components)),
+         ...);
     }
 
 private:
-    template <utils::concepts::pure Component, auto hash = utils::hash_of<Component>()>
-    void detach_impl(const entity::index_t index) {
-        const auto identity = component_registry::identity(hash);
-
-        if (auto iter = world_->component_storage_.find(identity);
-            iter != world_->component_storage_.cend()) [[likely]] {
-            auto& [map, allocator, reflected] = iter->second;
-            if (map.contains(index)) [[likely]] {
-                auto fn = [](void* ptr, utils::basic_allocator* allocator) -> void {
-                    if (ptr) [[likely]] {
-                        std::destroy_at(static_cast<Component*>(ptr));
-                        allocator->dealloc(ptr);
-                    }
-                };
-                world_->pending_components_.emplace_back(fn, map.at(index), allocator);
-                map.erase(index);
-            }
+    template <utils::concepts::pure Component>
+    void detach_impl(const entity::id_t entity) {
+        const auto identity         = component_index<Component>();
+        const entity::index_t index = entity >> magic_32;
+        auto& signature             = world_->entities_.signature_of(index);
+        if (signature.test(identity)) {
+            world_->log_removal(entity, identity, tick_);
+        }
+        signature.reset(identity);
+        if constexpr (is_table_component_v<Component>) {
+            world_->archetypes_.erase(index, component_index<Component>());
+        }
+        else if (auto* storage = world_->storage_of<Component>()) [[likely]] {
+            storage->erase(index);
         }
     }
 
 public:
     template <typename... Components>
     auto detach(const ECS entity::id_t entity) -> void {
-        const entity::index_t index = entity >> magic_32;
-        (detach_impl<Components>(index), ...);
+        if (auto* buffer = deferral()) [[unlikely]] {
+            buffer->push([world = world_, entity] {
+                replay(world).detach<Components...>(entity);
+            });
+            return;
+        }
+
+        (detach_impl<Components>(entity), ...);
+        (refresh_queries(component_index<Components>(), entity), ...);
     }
 
     auto kill(const ::atom::ecs::entity::id_t entity) -> void {
-        world_->pending_destroy_.emplace_back(entity);
-        world_->living_entities_.erase(entity);
+        if (auto* buffer = deferral()) [[unlikely]] {
+            buffer->push([world = world_, entity] { replay(world).kill(entity); });
+            return;
+        }
+
+        if (world_->entities_.erase(entity)) [[likely]] {
+            const auto index = static_cast<entity::index_t>(entity >> magic_32);
+            world_->pending_destroy_.emplace_back(index);
+            world_->log_removals(entity, world_->entities_.signature_of(index), tick_);
+            forget_queries(index);
+        }
     }
 
-#if _HAS_CXX23
-    template <std::ranges::range Rng>
-    requires std::is_same_v<std::iter_value_t<Rng>, entity::id_t>
+    /**
+     * @brief Kill a range of entities.
+     *
+     * Queries are updated after the whole range is recorded, so the range could be a query.
+     */
+    template <std::ranges::input_range Rng>
+    requires std::is_same_v<std::ranges::range_value_t<Rng>, entity::id_t>
     auto kill(Rng&& range) -> void {
-        world_->pending_destroy_.append_range(std::forward<Rng>(range));
-        // TODO: erase
-    }
-#else
-    template <std::ranges::range Rng>
-    requires std::is_same_v<std::iter_value_t<Rng>, entity::id_t>
-    auto kill(const Rng& range) {
+        if (auto* buffer = deferral()) [[unlikely]] {
+            vector<entity::id_t> entities{ world_->frame_arena() };
+            std::ranges::copy(range, std::back_inserter(entities));
+            buffer->push([world = world_, entities = std::move(entities)] {
+                replay(world).kill(entities);
+            });
+            return;
+        }
+
+        auto& pending     = world_->pending_destroy_;
+        const auto offset = pending.size();
+        if constexpr (std::ranges::sized_range<Rng>) {
+            pending.reserve(offset + std::ranges::size(range));
+        }
+
         for (const entity::id_t entity : range) {
-            world_->pending_destroy_.emplace_back(entity);
-            world_->living_entities_.erase(entity);
+            if (world_->entities_.erase(entity)) [[likely]] {
+                const auto index = static_cast<entity::index_t>(entity >> magic_32);
+                pending.emplace_back(index);
+                world_->log_removals(entity, world_->entities_.signature_of(index), tick_);
+            }
+        }
+        for (auto i = offset; i < pending.size(); ++i) {
+            forget_queries(pending[i]);
         }
     }
-#endif
 
     ///////////////////////////////////////////////////////////////////////
     // Resources
     ///////////////////////////////////////////////////////////////////////
 
 private:
-    template <typename Resource, auto hash = utils::hash_of<Resource>()>
+    template <typename Resource>
     requires(!concepts::asset<Resource>)
     void add_impl() {
-        const auto identity = resource_registry::identity(hash);
-
-        using storage_t = UTILS unique_storage<Resource, UTILS builtin_storage_allocator<Resource>>;
-        if (!world_->resource_storage_.contains(identity)) [[likely]] {
-            world_->resource_storage_.emplace(identity, new storage_t(utils::construct_at_once));
+        static_cast<void>(internal::snapshot_resource_enrolled<Resource>);
+        if (resource_slot& slot = world_->resources_.slot<Resource>(); !slot.get()) [[likely]] {
+            slot.emplace<Resource>();
         }
     }
 
@@ -227,137 +457,230 @@ public:
     template <typename... Resources>
     requires((std::is_same_v<std::remove_cvref_t<Resources>, Resources> && ...))
     void add() {
+        if (auto* buffer = deferral()) [[unlikely]] {
+            buffer->push([world = world_] { replay(world).add<Resources...>(); });
+            return;
+        }
         (add_impl<Resources>(), ...);
     }
 
 private:
-    template <
-        utils::concepts::pure Resource,
-        typename ResourceTy,
-        auto hash = utils::hash_of<Resource>()>
+    template <utils::concepts::pure Resource, typename ResourceTy>
     void add_impl(ResourceTy&& val) {
-        const auto identity = resource_registry::identity(hash);
-
+        static_cast<void>(internal::snapshot_resource_enrolled<Resource>);
         if constexpr (concepts::asset<Resource>) {
             // TODO:
             auto& hub = hub::instance();
         }
 
-        using storage_t = utils::unique_storage<Resource>;
-        if (!world_->resource_storage_.contains(identity)) {
-            auto* storage = new storage_t(std::forward<ResourceTy>(val));
-            world_->resource_storage_.emplace(identity, storage);
+        if (resource_slot& slot = world_->resources_.slot<Resource>(); !slot.get()) {
+            slot.emplace<Resource>(std::forward<ResourceTy>(val));
         }
     }
 
 public:
     template <utils::concepts::pure... Resource, typename... ResourceTys>
     void add(ResourceTys&&... resources) {
+        if (auto* buffer = deferral()) [[unlikely]] {
+            buffer->push(
+                [world = world_, ... values = std::forward<ResourceTys>(resources)]() mutable {
+                    replay(world).add<Resource...>(std::move(values)...);
+                }
+            );
+            return;
+        }
         (add_impl<Resource>(std::forward<ResourceTys>(resources)), ...);
     }
 
 private:
-    template <
-        utils::concepts::pure Resource,
-        typename ResourceTy,
-        auto hash = utils::hash_of<Resource>()>
+    template <utils::concepts::pure Resource, typename ResourceTy>
     void set_impl(ResourceTy&& val) {
         ATOM_DEBUG_SHOW_FUNC
 
-        const auto identity = resource_registry::identity(hash);
-
-        using storage_t = UTILS unique_storage<Resource>;
-        if (auto iter = world_->resource_storage_.find(identity);
-            iter != world_->resource_storage_.cend()) [[likely]] {
-            utils::basic_storage* basic_storage = world_->resource_storage_.at(identity);
-            auto* storage                       = static_cast<storage_t*>(basic_storage);
-            *storage                            = std::forward<ResourceTy>(val);
+        if (auto* resource = world_->resources_.slot<Resource>().get()) [[likely]] {
+            *static_cast<Resource*>(resource) = std::forward<ResourceTy>(val);
         }
     }
 
 public:
     template <utils::concepts::pure... Resources, typename... ResourceTys>
     void set(ResourceTys&&... resources) {
+        if (auto* buffer = deferral()) [[unlikely]] {
+            buffer->push(
+                [world = world_, ... values = std::forward<ResourceTys>(resources)]() mutable {
+                    replay(world).set<Resources...>(std::move(values)...);
+                }
+            );
+            return;
+        }
         (set_impl<Resources>(std::forward<ResourceTys>(resources)), ...);
     }
 
 private:
-    template <utils::concepts::pure Resource, auto hash = utils::hash_of<Resource>()>
+    template <utils::concepts::pure Resource>
     void remove_impl() {
-        const auto identity = resource_registry::identity(hash);
-        if (world_->resource_storage_.contains(identity)) [[likely]] {
-            utils::basic_storage* storage = world_->resource_storage_.at(identity);
-            delete storage;
-            world_->resource_storage_.erase_without_check(identity);
-        }
+        world_->resources_.slot<Resource>().reset();
     }
 
 public:
     template <utils::concepts::pure... Resources>
     void remove() {
+        if (auto* buffer = deferral()) [[unlikely]] {
+            buffer->push([world = world_] { replay(world).remove<Resources...>(); });
+            return;
+        }
         (remove_impl<Resources>(), ...);
     }
 
+    /**
+     * @brief Memory resource for scratch memory of this frame, e.g. `vector<T>{ resource }`.
+     *
+     * Allocations are valid until the end of the next update, then they are taken back at once
+     * without being deallocated, so only trivially destructible objects should outlive their
+     * containers. Allocating is thread safe.
+     */
+    [[nodiscard]] auto frame_resource() const noexcept -> std::pmr::memory_resource* {
+        return world_->frame_arena();
+    }
+
+    /**
+     * @brief Send an event, it could be read in the next update.
+     *
+     * Sending takes no lock and is not deferred, systems that send the same event could run at
+     * the same time.
+     *
+     * @tparam Event Event type.
+     * @param args Arguments to construct the event.
+     */
+    template <utils::concepts::pure Event, typename... Args>
+    void send(Args&&... args) {
+        world_->events_.channel<Event>().send(std::forward<Args>(args)...);
+    }
+
 private:
-    void update_garbage_collect() {
-        // single component
-        for (auto& [del, ptr, allocator] : world_->pending_components_) {
-            del(ptr, allocator);
-        }
-        world_->pending_components_.clear();
-
-        // whole entity
-        for (auto entity : world_->pending_destroy_) {
-            const entity::index_t index = entity >> magic_32;
-            for (auto& [map, allocator, reflected] :
-                 world_->component_storage_ | std::views::values) {
-                if (auto iter = map.find(index); iter != map.end()) {
-                    if (iter->second) [[likely]] {
-                        reflected->destroy(iter->second);
-                        allocator->dealloc(iter->second);
-                    }
-                    map.erase(index);
-                }
+    // command that applies a record, the ids reserved by deferred systems are alive by then. The
+    // changes get a new tick, so that they are new to every system that ran before the sync point.
+    static auto replay(ECS world* world) -> command {
+        world->entities_.flush();
+        return command{ world };
+    }
+
+    // the buffer changes are recorded into, `nullptr` when they are applied right away. A thread
+    // of a parallel loop records into a buffer of the loop, any other thread has none.
+    [[nodiscard]] auto deferral() const -> command_buffer* {
+        auto* buffer = command_buffer::current();
+        if (deferred_ && !buffer) [[unlikely]] {
+            throw std::logic_error("Couldn't change the world outside of a deferred system!");
+        }
+        return buffer;
+    }
+
+    template <typename Component>
+    [[nodiscard]] auto ticks_of(const entity::index_t index, const component::id_t identity) const
+        -> component_ticks* {
+        if constexpr (is_table_component_v<Component>) {
+            return world_->archetypes_.ticks_of(index, identity);
+        }
+        else {
+            return world_->storage_of<Component>()->ticks_of(index);
+        }
+    }
+
+    template <typename Component>
+    void stamp_added(const entity::index_t index) const {
+        *ticks_of<Component>(index, component_index<Component>()) = { tick_, tick_ };
+    }
+
+    void enter_queries(const entity::id_t entity) {
+        for (auto* query : world_->unbounded_queries_) {
+            query->insert(entity);
+        }
+    }
+
+    void refresh_queries(const component::id_t identity, const entity::id_t entity) {
+        if (identity < world_->query_index_.size() && !world_->query_index_[identity].empty())
+            [[unlikely]] {
+            if (!world_->entities_.contains(entity)) {
+                return;
+            }
+
+            auto has = [world = world_](const component::id_t id, const entity::index_t index) {
+                return world->contains(id, index);
+            };
+            for (auto* query : world_->query_index_[identity]) {
+                query->refresh(entity, has);
             }
-            world_->free_indices_.emplace_back(static_cast<entity::index_t>(index));
-            ++world_->generations_[index];
         }
-        world_->pending_destroy_.clear();
     }
 
-    void shutdown_garbage_collect() {
-        // entities and their components
+    void forget_queries(const entity::index_t index) {
+        for (auto& query : world_->cached_queries_ | std::views::values) {
+            query->erase(index);
+        }
+    }
 
-        for (auto& [del, ptr, allocator] : world_->pending_components_) {
-            del(ptr, allocator);
+    void update_garbage_collect() {
+        auto& pending = world_->pending_destroy_;
+        if (pending.empty()) {
+            return;
         }
-        world_->pending_components_.clear();
 
-        for (auto& [map, allocator, reflected] : world_->component_storage_ | std::views::values) {
-            for (auto* ptr : map | std::views::values) {
-                if (ptr) [[likely]] {
-                    reflected->destroy(ptr);
-                    allocator->dealloc(ptr);
+        // group the killed entities by the sparse sets they are in, by their signatures, so that
+        // only those storages are visited and each one is swept once.
+        const auto& storages = world_->component_storage_;
+        auto& lists          = world_->sweep_lists_;
+        if (lists.size() < storages.size()) {
+            lists.resize(storages.size());
+        }
+        bool in_tables{};
+        for (const auto index : pending) {
+            world_->entities_.signature_of(index).for_each([&](const component::id_t id) {
+                if (id < storages.size() && std::get<0>(storages[id])) {
+                    lists[id].emplace_back(index);
                 }
+                else {
+                    in_tables = true;
+                }
+            });
+        }
+        for (std::size_t id = 0; id < lists.size(); ++id) {
+            if (!lists[id].empty()) {
+                std::get<0>(storages[id])->erase(lists[id]);
+                lists[id].clear();
             }
+        }
 
-            delete allocator;
+        for (const auto index : pending) {
+            if (in_tables) {
+                world_->archetypes_.erase(index);
+            }
+            world_->entities_.release(index);
+        }
+        pending.clear();
+    }
+
+    void shutdown_garbage_collect() {
+        // entities and their components
+
+        for (auto& [storage, reflected] : world_->component_storage_) {
+            delete storage;
             delete reflected;
-            allocator = nullptr;
+            storage   = nullptr;
             reflected = nullptr;
         }
         world_->component_storage_.clear();
+        world_->sweep_lists_.clear();
+        world_->archetypes_.clear();
 
         // resources
 
-        for (auto* storage : world_->resource_storage_ | std::views::values) {
-            delete storage;
-        }
-        world_->resource_storage_.clear();
+        world_->resources_.clear();
     }
 
 private:
     ECS world* world_;
+    component::tick_t tick_;
+    bool deferred_{};
 };
 
 } // namespace atom::ecs
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "containers.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Structural changes recorded by a system, applied later at a sync point.
+ *
+ * Records are closures placed one after another in blocks that are kept between frames, so
+ * recording is a bump of an offset once the blocks are warm. While a `scope` is active on a
+ * thread, `command` records into its buffer instead of changing the world.
+ */
+class command_buffer {
+public:
+    /**
+     * @brief Make `command` record into a buffer on this thread, until the scope ends.
+     *
+     */
+    class scope {
+    public:
+        explicit scope(command_buffer* buffer) noexcept;
+
+        scope(const scope&)            = delete;
+        scope& operator=(const scope&) = delete;
+
+        ~scope() noexcept;
+
+    private:
+        command_buffer* previous_;
+    };
+
+    command_buffer() noexcept = default;
+
+    command_buffer(const command_buffer&)            = delete;
+    command_buffer& operator=(const command_buffer&) = delete;
+
+    command_buffer(command_buffer&& that) noexcept;
+    command_buffer& operator=(command_buffer&& that) noexcept;
+
+    ~command_buffer() noexcept;
+
+    /**
+     * @brief The buffer `command` records into on this thread, if any.
+     *
+     */
+    [[nodiscard]] static auto current() noexcept -> command_buffer*;
+
+    /**
+     * @brief Record a closure that takes no arguments.
+     *
+     */
+    template <typename Func>
+    void push(Func&& func) {
+        using closure_t = closure<std::decay_t<Func>>;
+        static_assert(alignof(closure_t) <= alignof(std::max_align_t));
+
+        auto* record = ::new (allocate(sizeof(closure_t))) closure_t(std::forward<Func>(func));
+        record->invoke = [](basic_record* self) {
+            static_cast<closure_t*>(self)->func();
+        };
+        record->destroy = [](basic_record* self) noexcept {
+            static_cast<closure_t*>(self)->~closure_t();
+        };
+        if (tail_) {
+            tail_->next = record;
+        }
+        else {
+            head_ = record;
+        }
+        tail_ = record;
+    }
+
+    /**
+     * @brief Run the records in the order they were recorded, then drop them.
+     *
+     * If a record throws, the rest are dropped without running.
+     */
+    void apply();
+
+    /**
+     * @brief Drop the records without running them. The memory is kept.
+     *
+     */
+    void clear() noexcept;
+
+    [[nodiscard]] auto empty() const noexcept -> bool { return !head_; }
+
+private:
+    struct basic_record {
+        void (*invoke)(basic_record*);
+        void (*destroy)(basic_record*) noexcept;
+        basic_record* next;
+    };
+
+    template <typename Func>
+    struct closure : basic_record {
+        template <typename Fn>
+        explicit closure(Fn&& fn) : basic_record{}, func(std::forward<Fn>(fn)) {}
+
+        Func func;
+    };
+
+    struct block {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+
+    constexpr static std::size_t first_block_size = 4096;
+
+    auto allocate(std::size_t size) -> void*;
+
+    vector<block> blocks_;
+    std::size_t block_{};
+    std::size_t offset_{};
+    basic_record* head_{};
+    basic_record* tail_{};
+};
+
+} // namespace atom::ecs
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+
+namespace atom::ecs {
+
+namespace internal {
+
+/**
+ * @brief Largest block kept in the pools of a component resource, bigger ones go upstream.
+ *
+ * Arrays double as they grow, and a pooled block is only reused by arrays of its size class, so
+ * large arrays are left to the upstream resource, which gives their old blocks back.
+ */
+constexpr std::size_t largest_pooled_block = std::size_t{ 1 } << 14;
+
+} // namespace internal
+
+/**
+ * @brief Memory resource of a type of component, for its packed arrays and table columns.
+ *
+ * Each type of component has its own `std::pmr::synchronized_pool_resource`, so small arrays of a
+ * type are carved from the same chunks and storages of different types never share a lock. The
+ * standard only promises that the resource is thread safe, not how it locks. Components are
+ * packed, so it is only reached when an array grows, not once per component. Chunks of the pools
+ * are not given back upstream.
+ *
+ * @tparam Component Component type.
+ */
+template <typename Component>
+[[nodiscard]] auto component_resource() -> std::pmr::memory_resource* {
+    // never destroyed: storages of a world that is destroyed late still give their blocks back.
+    static auto* const resource = new std::pmr::synchronized_pool_resource{
+        std::pmr::pool_options{ 0, internal::largest_pooled_block }
+    };
+    return resource;
+}
+
+} // namespace atom::ecs
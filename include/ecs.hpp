@@ -1,10 +1,18 @@
 #pragma once
+#include <atomic>
 #include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include "core.hpp"
 #include "reflection.hpp"
 
 #define ECS ::atom::ecs::
 
+#ifndef ATOM_ECS_MAX_COMPONENTS
+    #define ATOM_ECS_MAX_COMPONENTS 256
+#endif
+
 namespace atom::ecs {
 
 namespace entity {
@@ -14,13 +22,65 @@ using id_t         = uint64_t;
 } // namespace entity
 
 struct component {
-    using id_t = default_id_t;
+    using id_t   = default_id_t;
+    using tick_t = std::uint32_t;
 };
 
+/**
+ * @brief When a component was attached and when it was last changed, in ticks of its world.
+ *
+ */
+struct component_ticks {
+    component::tick_t added;
+    component::tick_t changed;
+};
+
+/**
+ * @brief Whether a tick is later than another one.
+ *
+ * Ticks wrap around, so they are compared by their distance, which holds while they are less
+ * than 2^31 apart, see `clamp_tick`.
+ */
+[[nodiscard]] constexpr auto is_newer(const component::tick_t tick, const component::tick_t than)
+    -> bool {
+    return static_cast<std::int32_t>(tick - than) > 0;
+}
+
+/**
+ * @brief How old a stored tick may get, older ones are clamped to this age.
+ *
+ * The world clamps every stored tick each `tick_clamp_interval` ticks, so no two ticks it compares
+ * are more than `max_tick_age + tick_clamp_interval` apart, which is below 2^31.
+ */
+constexpr component::tick_t max_tick_age        = component::tick_t{ 1 } << 30;
+constexpr component::tick_t tick_clamp_interval = component::tick_t{ 1 } << 29;
+
+/**
+ * @brief A tick moved forward to `current - max_tick_age` if it is older than that.
+ *
+ */
+[[nodiscard]] constexpr auto clamp_tick(
+    const component::tick_t tick, const component::tick_t current
+) noexcept -> component::tick_t {
+    const auto oldest = static_cast<component::tick_t>(current - max_tick_age);
+    return is_newer(oldest, tick) ? oldest : tick;
+}
+
+/**
+ * @brief Max number of component types, which is the width of an entity's signature.
+ *
+ */
+constexpr std::size_t max_components = ATOM_ECS_MAX_COMPONENTS;
+static_assert(max_components && max_components % 64 == 0);
+
 struct resource {
     using id_t = default_id_t;
 };
 
+struct event {
+    using id_t = default_id_t;
+};
+
 using resource_handle = uint32_t;
 
 enum class asset_type : unsigned char;
@@ -47,6 +107,53 @@ using component_registry = utils::registry<component>;
 
 using resource_registry = utils::registry<resource>;
 
+namespace internal {
+
+template <typename Category>
+[[nodiscard]] inline auto next_index() noexcept -> default_id_t {
+    static std::atomic<default_id_t> counter;
+    return counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace internal
+
+/**
+ * @brief Dense index of a type of component, assigned at the first use and then cached.
+ *
+ * Storages of a world are kept in an array indexed by it.
+ */
+template <typename Component>
+[[nodiscard]] inline auto component_index() -> component::id_t {
+    static const component::id_t index = [] {
+        const auto index = internal::next_index<component>();
+        if (index >= max_components) [[unlikely]] {
+            throw std::runtime_error("Too many component types, raise ATOM_ECS_MAX_COMPONENTS!");
+        }
+        return index;
+    }();
+    return index;
+}
+
+/**
+ * @brief Dense index of a type of resource, assigned at the first use and then cached.
+ *
+ */
+template <typename Resource>
+[[nodiscard]] inline auto resource_index() noexcept -> resource::id_t {
+    static const resource::id_t index = internal::next_index<resource>();
+    return index;
+}
+
+/**
+ * @brief Dense index of a type of event, assigned at the first use and then cached.
+ *
+ */
+template <typename Event>
+[[nodiscard]] inline auto event_index() noexcept -> event::id_t {
+    static const event::id_t index = internal::next_index<event>();
+    return index;
+}
+
 // NOLINTBEGIN(cppcoreguidelines-macro-usage)
 
 #define REGISTER_COMPONENT(component_name, register_name)                                          \
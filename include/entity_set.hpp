@@ -0,0 +1,330 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include "containers.hpp"
+#include "ecs.hpp"
+#include "mask_filter.hpp"
+#include "signature.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Living entities of a world.
+ *
+ * An entity is alive when the bit of its index is set and its generation is the current one of
+ * that index, so checking it is two loads. Iterating visits the set bits word by word, in index
+ * order. Index 0 is reserved and never handed out.
+ *
+ * The signature of each index is kept next to its generation. It stays until the index is
+ * released, so the components of a killed entity can still be found by garbage collection.
+ *
+ * Ids can be reserved from several threads at once while nothing else changes the set. They are
+ * taken from the released indices first, then past the end, and become living entities on the
+ * next `flush`.
+ */
+class entity_set {
+    using word_type = std::uint64_t;
+
+    constexpr static std::size_t word_bits = sizeof(word_type) * 8;
+
+public:
+    class iterator {
+    public:
+        using value_type        = entity::id_t;
+        using difference_type   = std::ptrdiff_t;
+        using iterator_concept  = std::forward_iterator_tag;
+        using iterator_category = std::forward_iterator_tag;
+
+        iterator() noexcept = default;
+        iterator(const entity_set* set, const std::size_t index) noexcept
+            : set_(set), index_(index) {
+            satisfy();
+        }
+
+        [[nodiscard]] auto operator*() const noexcept -> entity::id_t {
+            return set_->id_of(static_cast<entity::index_t>(index_));
+        }
+
+        auto operator++() noexcept -> iterator& {
+            ++index_;
+            satisfy();
+            return *this;
+        }
+
+        auto operator++(int) noexcept -> iterator {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        [[nodiscard]] friend auto operator==(const iterator& lhs, const iterator& rhs) noexcept
+            -> bool {
+            return lhs.index_ == rhs.index_;
+        }
+
+    private:
+        // move to the next set bit at or after `index_`, or to the end.
+        void satisfy() noexcept {
+            const auto& alive = set_->alive_;
+            const auto end    = set_->generations_.size();
+            auto word         = index_ / word_bits;
+            if (index_ >= end) {
+                index_ = end;
+                return;
+            }
+
+            auto bits = alive[word] & (~word_type{} << (index_ % word_bits));
+            while (!bits) {
+                if (++word == alive.size()) {
+                    index_ = end;
+                    return;
+                }
+                bits = alive[word];
+            }
+            index_ = word * word_bits + std::countr_zero(bits);
+        }
+
+        const entity_set* set_{};
+        std::size_t index_{};
+    };
+
+    entity_set() : generations_(1, 0), signatures_(1), alive_(1, 0), cursor_(0) {}
+
+    [[nodiscard]] auto contains(const entity::id_t entity) const noexcept -> bool {
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        return index < generations_.size() && test(index) &&
+               generations_[index] == static_cast<entity::generation_t>(entity);
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return size_; }
+    [[nodiscard]] auto empty() const noexcept -> bool { return !size_; }
+
+    [[nodiscard]] auto begin() const noexcept -> iterator { return iterator{ this, 0 }; }
+    [[nodiscard]] auto end() const noexcept -> iterator {
+        return iterator{ this, generations_.size() };
+    }
+
+    [[nodiscard]] auto generation(const entity::index_t index) const noexcept
+        -> entity::generation_t {
+        return generations_[index];
+    }
+
+    [[nodiscard]] auto signature_of(const entity::index_t index) noexcept -> signature& {
+        return signatures_[index];
+    }
+
+    [[nodiscard]] auto signature_of(const entity::index_t index) const noexcept
+        -> const signature& {
+        return signatures_[index];
+    }
+
+    /**
+     * @brief Signatures of all the indices, handed out or not.
+     *
+     */
+    [[nodiscard]] auto signatures() const noexcept -> const vector<signature>& {
+        return signatures_;
+    }
+
+    /**
+     * @brief The alive bits, one per index, 64 indices a word.
+     *
+     */
+    [[nodiscard]] auto alive_words() const noexcept -> const vector<word_type>& { return alive_; }
+
+    /**
+     * @brief Generations of all the indices, handed out or not.
+     *
+     */
+    [[nodiscard]] auto generations() const noexcept -> const vector<entity::generation_t>& {
+        return generations_;
+    }
+
+    /**
+     * @brief Released indices, the last one is reused first.
+     *
+     */
+    [[nodiscard]] auto free_indices() const noexcept -> const vector<entity::index_t>& {
+        return free_indices_;
+    }
+
+    /**
+     * @brief Replace all the entities, e.g. by the ones of a snapshot. Signatures are cleared.
+     *
+     * No id may be reserved. The arrays are the ones returned by `generations`, `alive_words` and
+     * `free_indices`.
+     */
+    void assign(
+        const std::span<const entity::generation_t> generations,
+        const std::span<const word_type> alive,
+        const std::span<const entity::index_t> free
+    ) {
+        generations_.assign(generations.begin(), generations.end());
+        alive_.assign(alive.begin(), alive.end());
+        free_indices_.assign(free.begin(), free.end());
+        signatures_.clear();
+        signatures_.resize(generations_.size());
+        size_ = 0;
+        for (const auto word : alive_) {
+            size_ += static_cast<std::size_t>(std::popcount(word));
+        }
+        cursor_.store(static_cast<std::ptrdiff_t>(free_indices_.size()), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Indices of the living entities that have all of `include` and none of `exclude`.
+     *
+     */
+    void select(
+        const signature& include, const signature& exclude, vector<entity::index_t>& output
+    ) const {
+        mask_filter::select(
+            signatures_.data(), alive_.data(), signatures_.size(), include, exclude, output
+        );
+    }
+
+    /**
+     * @brief Id of the entity currently living at, or next handed out for, an index.
+     *
+     */
+    [[nodiscard]] auto id_of(const entity::index_t index) const noexcept -> entity::id_t {
+        return (static_cast<entity::id_t>(index) << magic_32) | generations_[index];
+    }
+
+    /**
+     * @brief Make room for `count` more living entities.
+     *
+     */
+    void reserve(const std::size_t count) {
+        if (count <= free_indices_.size()) {
+            return;
+        }
+
+        const auto capacity = generations_.size() + count - free_indices_.size();
+        generations_.reserve(capacity);
+        signatures_.reserve(capacity);
+        alive_.reserve((capacity + word_bits - 1) / word_bits);
+    }
+
+    /**
+     * @brief Make a new living entity, recycling a released index if there is any.
+     *
+     */
+    auto emplace() -> entity::id_t {
+        flush();
+
+        entity::index_t index{};
+        if (!free_indices_.empty()) {
+            index = free_indices_.back();
+            free_indices_.pop_back();
+            cursor_.store(
+                static_cast<std::ptrdiff_t>(free_indices_.size()), std::memory_order_relaxed
+            );
+        }
+        else {
+            index = grow();
+        }
+
+        revive(index);
+        return id_of(index);
+    }
+
+    /**
+     * @brief Hand out the id of a future entity. Thread safe against other reservations.
+     *
+     */
+    auto reserve_id() noexcept -> entity::id_t {
+        const auto left = cursor_.fetch_sub(1, std::memory_order_relaxed);
+        if (left > 0) {
+            return id_of(free_indices_[static_cast<std::size_t>(left - 1)]);
+        }
+        return static_cast<entity::id_t>(generations_.size() + static_cast<std::size_t>(-left))
+               << magic_32;
+    }
+
+    /**
+     * @brief Make the reserved ids living entities.
+     *
+     */
+    void flush() {
+        const auto cursor = cursor_.load(std::memory_order_relaxed);
+        const auto free   = static_cast<std::ptrdiff_t>(free_indices_.size());
+        if (cursor == free) [[likely]] {
+            return;
+        }
+
+        const auto kept = static_cast<std::size_t>(std::max<std::ptrdiff_t>(cursor, 0));
+        for (auto i = kept; i < free_indices_.size(); ++i) {
+            revive(free_indices_[i]);
+        }
+        free_indices_.resize(kept);
+        for (std::ptrdiff_t i = 0; i < -cursor; ++i) {
+            revive(grow());
+        }
+        cursor_.store(static_cast<std::ptrdiff_t>(kept), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Mark an entity dead. Its index is kept until `release`.
+     *
+     * @return `false` if the entity was not alive.
+     */
+    auto erase(const entity::id_t entity) noexcept -> bool {
+        if (!contains(entity)) [[unlikely]] {
+            return false;
+        }
+
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        alive_[index / word_bits] &= ~(word_type{ 1 } << (index % word_bits));
+        --size_;
+        return true;
+    }
+
+    /**
+     * @brief Bump the generation of a dead entity's index and make the index reusable.
+     *
+     * Its signature is cleared.
+     */
+    void release(const entity::index_t index) {
+        flush();
+        ++generations_[index];
+        signatures_[index].clear();
+        free_indices_.emplace_back(index);
+        cursor_.store(static_cast<std::ptrdiff_t>(free_indices_.size()), std::memory_order_relaxed);
+    }
+
+private:
+    auto grow() -> entity::index_t {
+        const auto index = static_cast<entity::index_t>(generations_.size());
+        generations_.emplace_back(0);
+        signatures_.emplace_back();
+        if (generations_.size() > alive_.size() * word_bits) [[unlikely]] {
+            alive_.emplace_back(0);
+        }
+        return index;
+    }
+
+    void revive(const entity::index_t index) noexcept {
+        alive_[index / word_bits] |= word_type{ 1 } << (index % word_bits);
+        ++size_;
+    }
+
+    [[nodiscard]] auto test(const entity::index_t index) const noexcept -> bool {
+        return (alive_[index / word_bits] >> (index % word_bits)) & 1U;
+    }
+
+    vector<entity::generation_t> generations_;
+    vector<signature> signatures_;
+    vector<word_type> alive_;
+    vector<entity::index_t> free_indices_;
+    // `free_indices_.size()` minus the reserved ids, below zero once they are past the end.
+    std::atomic<std::ptrdiff_t> cursor_;
+    std::size_t size_{};
+};
+
+} // namespace atom::ecs
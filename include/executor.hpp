@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "containers.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Work-stealing executor that runs systems and parallel iteration.
+ *
+ * Every worker owns a deque. A task submitted from a worker goes to the back of its own deque and
+ * is taken back LIFO, so dependent work stays on the thread that produced it. Tasks submitted from
+ * other threads are spread over the workers. An idle worker steals from the front of the others.
+ * Threads that wait for submitted work should call `try_run_one` instead of blocking right away.
+ */
+class executor {
+public:
+    using task = std::function<void()>;
+
+    /**
+     * @brief Start the workers.
+     *
+     * @param workers Number of worker threads, at least one.
+     */
+    explicit executor(std::size_t workers);
+
+    executor(const executor&)            = delete;
+    executor(executor&&)                 = delete;
+    executor& operator=(const executor&) = delete;
+    executor& operator=(executor&&)      = delete;
+
+    /**
+     * @brief Run the remaining tasks and join the workers.
+     *
+     */
+    ~executor();
+
+    /**
+     * @brief Queue a task. Tasks must not throw, an escaping exception terminates.
+     *
+     */
+    void submit(task task);
+
+    /**
+     * @brief Take a queued task and run it on the calling thread.
+     *
+     * @return Whether a task was run.
+     */
+    auto try_run_one() -> bool;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return count_; }
+
+private:
+    struct worker {
+        std::mutex mutex;
+        deque<task> tasks;
+        std::thread thread;
+    };
+
+    void work(std::size_t index);
+    auto pop(std::size_t index) -> task;
+    auto steal(std::size_t first) -> task;
+
+    std::size_t count_;
+    std::unique_ptr<worker[]> workers_;
+    std::atomic<std::size_t> pending_;
+    std::atomic<std::size_t> next_;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool stop_;
+};
+
+} // namespace atom::ecs
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include "containers.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Monotonic memory resource for scratch memory that lives for a frame.
+ *
+ * Allocating is a bump of the offset of the current block, which is safe from several threads.
+ * Deallocating does nothing, `reset` takes everything back at once and keeps the blocks, so once
+ * the blocks are warm a frame makes no allocation upstream.
+ */
+class frame_arena final : public std::pmr::memory_resource {
+public:
+    constexpr static std::size_t first_block_size = std::size_t{ 64 } << 10;
+
+    frame_arena();
+
+    frame_arena(const frame_arena&)            = delete;
+    frame_arena(frame_arena&&)                 = delete;
+    frame_arena& operator=(const frame_arena&) = delete;
+    frame_arena& operator=(frame_arena&&)      = delete;
+
+    ~frame_arena() noexcept override = default;
+
+    /**
+     * @brief Take back all the memory. Not thread safe.
+     *
+     */
+    void reset() noexcept;
+
+private:
+    struct block {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+        std::atomic<std::size_t> used;
+    };
+
+    auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override;
+    void do_deallocate(void*, std::size_t, std::size_t) noexcept override {}
+    [[nodiscard]] auto do_is_equal(const std::pmr::memory_resource& that) const noexcept
+        -> bool override {
+        return this == &that;
+    }
+
+    // move to the next block, making one that fits `bytes` if there is none.
+    void advance(block* full, std::size_t bytes);
+
+    vector<std::unique_ptr<block>> blocks_;
+    std::atomic<block*> current_;
+    std::size_t index_{};
+    std::mutex mutex_;
+};
+
+} // namespace atom::ecs
@@ -0,0 +1,207 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include "ecs.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Generational slot map from `resource_handle` to shared objects.
+ *
+ * A handle is the index of a slot and the generation of the slot when it was given out, a handle
+ * is never zero. `contains` is wait-free and `fetch` takes no lock of the table, readers only
+ * touch the slot they look up. Slots live in pages that are made on demand and never move.
+ * Indices freed by `erase` are reused by later inserts with a new generation, so stale handles
+ * are told apart.
+ *
+ * @tparam Value Type of the objects.
+ */
+template <typename Value>
+class handle_table {
+    constexpr static std::uint32_t index_bits  = 20;
+    constexpr static std::uint32_t index_mask  = (std::uint32_t{ 1 } << index_bits) - 1;
+    constexpr static std::uint32_t page_bits   = 12;
+    constexpr static std::size_t page_size     = std::size_t{ 1 } << page_bits;
+    constexpr static std::size_t page_count    = std::size_t{ 1 } << (index_bits - page_bits);
+    constexpr static std::uint32_t generations = std::uint32_t{ 1 } << (32 - index_bits);
+    constexpr static std::uint32_t none        = index_mask;
+
+    struct slot {
+        // the live handle, zero while the slot is free.
+        std::atomic<resource_handle> handle;
+        std::atomic<std::shared_ptr<Value>> value;
+        // written by the thread that owns the free index only.
+        std::uint32_t generation;
+        std::atomic<std::uint32_t> next_free;
+    };
+
+    struct page {
+        slot slots[page_size];
+    };
+
+public:
+    /**
+     * @brief Max number of objects at the same time.
+     *
+     */
+    constexpr static std::size_t capacity = index_mask;
+
+    handle_table() : pages_(std::make_unique<std::atomic<page*>[]>(page_count)) {}
+
+    handle_table(const handle_table&)            = delete;
+    handle_table(handle_table&&)                 = delete;
+    handle_table& operator=(const handle_table&) = delete;
+    handle_table& operator=(handle_table&&)      = delete;
+
+    ~handle_table() noexcept {
+        for (std::size_t i = 0; i < page_count; ++i) {
+            delete pages_[i].load(std::memory_order_acquire);
+        }
+    }
+
+    /**
+     * @brief Store an object and hand out a handle of it. Thread safe.
+     *
+     */
+    auto insert(std::shared_ptr<Value> value) -> resource_handle {
+        const auto index = acquire();
+        auto& target     = slot_at(index);
+        target.value.store(std::move(value), std::memory_order_release);
+        const auto handle = (target.generation << index_bits) | index;
+        target.handle.store(handle, std::memory_order_release);
+        return handle;
+    }
+
+    [[nodiscard]] auto contains(const resource_handle handle) const noexcept -> bool {
+        const auto* target = find(handle);
+        return target && target->handle.load(std::memory_order_acquire) == handle;
+    }
+
+    /**
+     * @brief Object of a handle.
+     *
+     * @return `nullptr` if the handle is stale or invalid.
+     */
+    [[nodiscard]] auto fetch(const resource_handle handle) const noexcept
+        -> std::shared_ptr<Value> {
+        const auto* target = find(handle);
+        if (!target) {
+            return nullptr;
+        }
+        auto value = target->value.load(std::memory_order_acquire);
+        // the slot could have been erased meanwhile, then the value is not the one of the handle.
+        if (target->handle.load(std::memory_order_acquire) != handle) {
+            return nullptr;
+        }
+        return value;
+    }
+
+    /**
+     * @brief Swap the object of a handle if it is still `expected`. Thread safe.
+     *
+     * @return False if the handle was erased or its object was replaced meanwhile.
+     */
+    auto replace(
+        const resource_handle handle,
+        const std::shared_ptr<Value>& expected,
+        std::shared_ptr<Value> desired
+    ) noexcept -> bool {
+        auto* target = const_cast<slot*>(find(handle));
+        if (!target) {
+            return false;
+        }
+        // while `expected` is alive no other object has its address, so a reused slot never
+        // matches.
+        auto current = expected;
+        return target->value.compare_exchange_strong(
+            current, std::move(desired), std::memory_order_acq_rel, std::memory_order_relaxed
+        );
+    }
+
+    /**
+     * @brief Drop the object of a handle, stale handles are ignored. Thread safe.
+     *
+     */
+    void erase(const resource_handle handle) noexcept {
+        auto* target  = const_cast<slot*>(find(handle));
+        auto expected = handle;
+        if (!target || !target->handle.compare_exchange_strong(
+                           expected, 0, std::memory_order_acq_rel, std::memory_order_relaxed
+                       )) {
+            return;
+        }
+        target->value.store(nullptr, std::memory_order_release);
+        target->generation = (target->generation + 1) % generations;
+        release(*target, handle & index_mask);
+    }
+
+private:
+    [[nodiscard]] auto find(const resource_handle handle) const noexcept -> const slot* {
+        const auto index = handle & index_mask;
+        if (!handle || index == none) {
+            return nullptr;
+        }
+        const auto* page = pages_[index >> page_bits].load(std::memory_order_acquire);
+        return page ? &page->slots[index & (page_size - 1)] : nullptr;
+    }
+
+    auto slot_at(const std::uint32_t index) -> slot& {
+        auto& entry   = pages_[index >> page_bits];
+        auto* current = entry.load(std::memory_order_acquire);
+        if (!current) [[unlikely]] {
+            // threads that race to make the page keep the first one.
+            auto created = std::make_unique<page>();
+            if (entry.compare_exchange_strong(
+                    current, created.get(), std::memory_order_acq_rel, std::memory_order_acquire
+                )) {
+                current = created.release();
+            }
+        }
+        return current->slots[index & (page_size - 1)];
+    }
+
+    // the free list is a stack of indices, its head is tagged against ABA.
+    auto acquire() -> std::uint32_t {
+        auto head = free_.load(std::memory_order_acquire);
+        while (static_cast<std::uint32_t>(head) != none) {
+            const auto index = static_cast<std::uint32_t>(head);
+            const auto next  = slot_at(index).next_free.load(std::memory_order_relaxed);
+            const auto tag   = (head >> 32) + 1;
+            if (free_.compare_exchange_weak(
+                    head, (tag << 32) | next, std::memory_order_acquire, std::memory_order_acquire
+                )) {
+                return index;
+            }
+        }
+
+        const auto index = next_.fetch_add(1, std::memory_order_relaxed);
+        if (index >= none) [[unlikely]] {
+            next_.fetch_sub(1, std::memory_order_relaxed);
+            throw std::runtime_error("Too many objects in a handle table!");
+        }
+        return index;
+    }
+
+    void release(slot& target, const std::uint32_t index) noexcept {
+        auto head = free_.load(std::memory_order_relaxed);
+        while (true) {
+            target.next_free.store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+            const auto tag = (head >> 32) + 1;
+            if (free_.compare_exchange_weak(
+                    head, (tag << 32) | index, std::memory_order_release, std::memory_order_relaxed
+                )) {
+                return;
+            }
+        }
+    }
+
+    std::unique_ptr<std::atomic<page*>[]> pages_;
+    // index zero is not handed out, so that no handle is zero.
+    std::atomic<std::uint32_t> next_{ 1 };
+    std::atomic<std::uint64_t> free_{ none };
+};
+
+} // namespace atom::ecs
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "containers.hpp"
+#include "ecs.hpp"
+#include "signature.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Filter a packed array of signatures against include and exclude masks.
+ *
+ * The kernel is chosen once at runtime: AVX2 or SSE2 on x86 when the CPU supports them and the
+ * signature width fits their registers, scalar otherwise. Define `ATOM_ECS_NO_SIMD` to always use
+ * the scalar one.
+ */
+struct mask_filter {
+    enum class kernel : unsigned char {
+        scalar,
+        sse2,
+        avx2
+    };
+
+    mask_filter() = delete;
+
+    /**
+     * @brief Append indices of living entities that have all of `include` and none of `exclude`.
+     *
+     * @param signatures Signatures indexed by entity index.
+     * @param alive One bit per entity index, at least `(count + 63) / 64` words.
+     * @param count Number of entity indices to test.
+     * @param output Selected indices are appended in ascending order.
+     */
+    static void select(
+        const signature* signatures,
+        const std::uint64_t* alive,
+        std::size_t count,
+        const signature& include,
+        const signature& exclude,
+        vector<entity::index_t>& output
+    );
+
+    /**
+     * @brief The kernel `select` uses on this machine.
+     *
+     */
+    [[nodiscard]] static auto active() noexcept -> kernel;
+};
+
+} // namespace atom::ecs
@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include "command_buffer.hpp"
+#include "containers.hpp"
+#include "schedule.hpp"
+
+namespace atom::ecs::internal {
+
+/**
+ * @brief Default number of entities in a chunk of parallel iteration.
+ *
+ */
+constexpr std::size_t default_grain = 1024;
+
+/**
+ * @brief Call `func(i)` for each `i` in `[0, count)`, on the executor and the calling thread.
+ *
+ * This is what `par_each` of queries and views runs on. `func` is called concurrently, so an item
+ * should only write to what it is given, e.g. the components of its entities.
+ *
+ * Items are claimed one at a time from a shared counter. The caller claims items as well and only
+ * waits for the items that were claimed by others, so it never waits for a helper that has not
+ * started, e.g. because all the workers are busy running systems that do the same. While waiting
+ * it runs other tasks of the executor. The first exception thrown by `func` is rethrown in the
+ * caller, after every claimed item is done.
+ *
+ * Each item records its commands into a buffer of its own, whichever thread runs it. The buffers
+ * are appended to the buffer of the caller in the order of the items, or applied before returning
+ * when the caller has none. They are dropped if `func` throws.
+ */
+template <typename Func>
+void parallel_for(const std::size_t count, Func&& func) {
+#ifndef ATOM_SINGLE_THREAD
+    struct control {
+        std::atomic<std::size_t> next;
+        std::atomic<std::size_t> done;
+        std::exception_ptr exception;
+        std::mutex mutex;
+    };
+
+    auto& executor     = scheduler::executor();
+    const auto helpers = std::min(count, executor.size() + 1) - 1;
+    if (!helpers) {
+        for (std::size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    vector<command_buffer> buffers(count);
+    auto block = std::make_shared<control>();
+    // helpers could outlive this call, they only touch `func` after claiming an item.
+    auto work = [block, count, &func, &buffers] {
+        for (auto i = block->next.fetch_add(1); i < count; i = block->next.fetch_add(1)) {
+            try {
+                command_buffer::scope scope{ &buffers[i] };
+                func(i);
+            }
+            catch (...) {
+                std::lock_guard guard{ block->mutex };
+                if (!block->exception) {
+                    block->exception = std::current_exception();
+                }
+            }
+            if (block->done.fetch_add(1) + 1 == count) {
+                block->done.notify_all();
+            }
+        }
+    };
+
+    for (std::size_t i = 0; i < helpers; ++i) {
+        executor.submit(work);
+    }
+    work();
+
+    // run other tasks while the claimed items finish, e.g. a system this one is waiting behind.
+    for (auto done = block->done.load(); done != count; done = block->done.load()) {
+        if (!executor.try_run_one()) {
+            block->done.wait(done);
+        }
+    }
+    if (block->exception) {
+        std::rethrow_exception(block->exception);
+    }
+
+    if (std::ranges::all_of(buffers, &command_buffer::empty)) {
+        return;
+    }
+    if (auto* parent = command_buffer::current()) {
+        parent->push([buffers = std::move(buffers)]() mutable {
+            for (auto& buffer : buffers) {
+                buffer.apply();
+            }
+        });
+    }
+    else {
+        for (auto& buffer : buffers) {
+            buffer.apply();
+        }
+    }
+#else
+    for (std::size_t i = 0; i < count; ++i) {
+        func(i);
+    }
+#endif
+}
+
+} // namespace atom::ecs::internal
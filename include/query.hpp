@@ -0,0 +1,380 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+#include "archetype.hpp"
+#include "containers.hpp"
+#include "ecs.hpp"
+#include "parallel.hpp"
+#include "sparse_set.hpp"
+
+namespace atom::ecs {
+
+template <typename... Components>
+struct all {};
+
+template <typename... Components>
+struct any {};
+
+template <typename... Components>
+struct none {};
+
+/**
+ * @brief A registered query, whose matching entities are kept up to date by `command`.
+ *
+ * Iterating it is a walk over a packed array of entity ids.
+ */
+class cached_query {
+    friend class command;
+    friend class world;
+
+public:
+    constexpr static std::uint32_t npos = (std::numeric_limits<std::uint32_t>::max)();
+
+    cached_query(
+        vector<component::id_t> all, vector<component::id_t> any, vector<component::id_t> none
+    )
+        : all_(std::move(all)), any_(std::move(any)), none_(std::move(none)) {}
+
+    cached_query(const cached_query&)            = delete;
+    cached_query(cached_query&&)                 = delete;
+    cached_query& operator=(const cached_query&) = delete;
+    cached_query& operator=(cached_query&&)      = delete;
+    ~cached_query()                              = default;
+
+    [[nodiscard]] auto entities() const noexcept -> const vector<entity::id_t>& {
+        return entities_;
+    }
+
+    [[nodiscard]] auto begin() const noexcept { return entities_.cbegin(); }
+    [[nodiscard]] auto end() const noexcept { return entities_.cend(); }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return entities_.size(); }
+    [[nodiscard]] auto empty() const noexcept -> bool { return entities_.empty(); }
+
+    [[nodiscard]] auto contains(const entity::id_t entity) const noexcept -> bool {
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        return index < slots_.size() && slots_[index] != npos && entities_[slots_[index]] == entity;
+    }
+
+    /**
+     * @brief Whether a change of this component could change the result.
+     *
+     */
+    [[nodiscard]] auto depends_on(const component::id_t id) const noexcept -> bool {
+        return std::ranges::find(all_, id) != all_.end() ||
+               std::ranges::find(any_, id) != any_.end() ||
+               std::ranges::find(none_, id) != none_.end();
+    }
+
+    /**
+     * @brief Whether an entity without any component matches.
+     *
+     */
+    [[nodiscard]] auto unbounded() const noexcept -> bool { return all_.empty() && any_.empty(); }
+
+    /**
+     * @brief Call a function with each matching entity, in chunks of `grain` in parallel.
+     *
+     */
+    template <typename Func>
+    void par_each(Func&& func, const std::size_t grain = internal::default_grain) const {
+        const auto step   = grain ? grain : 1;
+        const auto chunks = (entities_.size() + step - 1) / step;
+        internal::parallel_for(chunks, [this, &func, step](const std::size_t i) {
+            const auto last = std::min(entities_.size(), (i + 1) * step);
+            for (auto pos = i * step; pos < last; ++pos) {
+                func(entities_[pos]);
+            }
+        });
+    }
+
+private:
+    template <typename Has>
+    [[nodiscard]] auto matches(const entity::index_t index, Has&& has) const -> bool {
+        const auto contains = [&has, index](const component::id_t id) { return has(id, index); };
+        return std::ranges::all_of(all_, contains) &&
+               (any_.empty() || std::ranges::any_of(any_, contains)) &&
+               std::ranges::none_of(none_, contains);
+    }
+
+    template <typename Has>
+    void refresh(const entity::id_t entity, Has&& has) {
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        if (matches(index, std::forward<Has>(has))) {
+            insert(entity);
+        }
+        else {
+            erase(index);
+        }
+    }
+
+    void insert(const entity::id_t entity) {
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        if (index >= slots_.size()) {
+            slots_.resize(static_cast<std::size_t>(index) + 1, npos);
+        }
+        if (slots_[index] == npos) {
+            slots_[index] = static_cast<std::uint32_t>(entities_.size());
+            entities_.emplace_back(entity);
+        }
+    }
+
+    void clear() noexcept {
+        slots_.clear();
+        entities_.clear();
+    }
+
+    void erase(const entity::index_t index) noexcept {
+        if (index >= slots_.size() || slots_[index] == npos) {
+            return;
+        }
+
+        const auto slot = slots_[index];
+        const auto back = entities_.back();
+        entities_[slot] = back;
+        slots_[static_cast<entity::index_t>(back >> magic_32)] = slot;
+        slots_[index]                                          = npos;
+        entities_.pop_back();
+    }
+
+    vector<component::id_t> all_;
+    vector<component::id_t> any_;
+    vector<component::id_t> none_;
+    vector<std::uint32_t> slots_;
+    vector<entity::id_t> entities_;
+};
+
+} // namespace atom::ecs
+
+namespace atom::ecs::internal {
+
+/**
+ * @brief Membership test of a type of component, resolved once per query.
+ *
+ */
+struct component_probe {
+    const basic_sparse_set* storage;
+    const archetype_storage* tables;
+    component::id_t identity;
+
+    [[nodiscard]] auto contains(const entity::index_t index) const noexcept -> bool {
+        if (tables) {
+            return tables->contains(index, identity);
+        }
+        return storage && storage->contains(index);
+    }
+
+    /**
+     * @brief Number of entities that would be visited when iterating this component.
+     *
+     */
+    [[nodiscard]] auto candidates() const noexcept -> std::size_t {
+        if (tables) {
+            std::size_t count{};
+            for (const auto& table : tables->archetypes()) {
+                if (table->contains(identity)) {
+                    count += table->size();
+                }
+            }
+            return count;
+        }
+        return storage ? storage->size() : 0;
+    }
+
+    /**
+     * @brief Append the packed entity arrays that hold this component.
+     *
+     */
+    template <typename Segments>
+    void segments(Segments& segments, const std::size_t tag) const {
+        if (tables) {
+            for (const auto& table : tables->archetypes()) {
+                if (table->size() && table->contains(identity)) {
+                    segments.emplace_back(&table->entities(), tag);
+                }
+            }
+        }
+        else if (storage && !storage->empty()) {
+            segments.emplace_back(&storage->entities(), tag);
+        }
+    }
+};
+
+/**
+ * @brief Collect component ids of the filters of a cached query.
+ *
+ */
+template <typename Filter>
+struct query_filter;
+
+template <typename... Components>
+struct query_filter<all<Components...>> {
+    static void collect(
+        vector<component::id_t>& all, vector<component::id_t>&, vector<component::id_t>&
+    ) {
+        (all.emplace_back(component_index<std::remove_const_t<Components>>()), ...);
+    }
+};
+
+template <typename... Components>
+struct query_filter<any<Components...>> {
+    static void collect(
+        vector<component::id_t>&, vector<component::id_t>& any, vector<component::id_t>&
+    ) {
+        (any.emplace_back(component_index<std::remove_const_t<Components>>()), ...);
+    }
+};
+
+template <typename... Components>
+struct query_filter<none<Components...>> {
+    static void collect(
+        vector<component::id_t>&, vector<component::id_t>&, vector<component::id_t>& none
+    ) {
+        (none.emplace_back(component_index<std::remove_const_t<Components>>()), ...);
+    }
+};
+
+using segment_list = vector<std::pair<const vector<entity::id_t>*, std::size_t>>;
+
+/**
+ * @brief Forward range over several packed entity arrays, filtered by a predicate.
+ *
+ * The predicate receives the entity and the tag of the array it comes from.
+ */
+template <typename Pred>
+class segmented_view : public std::ranges::view_interface<segmented_view<Pred>> {
+public:
+    class iterator {
+    public:
+        using value_type        = entity::id_t;
+        using difference_type   = std::ptrdiff_t;
+        using iterator_concept  = std::forward_iterator_tag;
+        using iterator_category = std::forward_iterator_tag;
+
+        iterator() noexcept = default;
+        iterator(const segmented_view* view, const std::size_t segment) noexcept
+            : view_(view), segment_(segment) {
+            satisfy();
+        }
+
+        [[nodiscard]] auto operator*() const noexcept -> entity::id_t {
+            return (*view_->segments_[segment_].first)[offset_];
+        }
+
+        auto operator++() noexcept -> iterator& {
+            ++offset_;
+            satisfy();
+            return *this;
+        }
+
+        auto operator++(int) noexcept -> iterator {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        [[nodiscard]] friend auto operator==(const iterator& lhs, const iterator& rhs) noexcept
+            -> bool {
+            return lhs.segment_ == rhs.segment_ && lhs.offset_ == rhs.offset_;
+        }
+
+        [[nodiscard]] friend auto operator==(const iterator& iter, std::default_sentinel_t) noexcept
+            -> bool {
+            return iter.done();
+        }
+
+    private:
+        [[nodiscard]] auto done() const noexcept -> bool {
+            return segment_ == view_->segments_.size();
+        }
+
+        void satisfy() noexcept {
+            const auto& segments = view_->segments_;
+            for (; segment_ < segments.size(); ++segment_, offset_ = 0) {
+                const auto& [entities, tag] = segments[segment_];
+                for (; offset_ < entities->size(); ++offset_) {
+                    if ((*view_->pred_)((*entities)[offset_], tag)) {
+                        return;
+                    }
+                }
+            }
+        }
+
+        const segmented_view* view_{};
+        std::size_t segment_{};
+        std::size_t offset_{};
+    };
+
+    segmented_view() = default;
+    segmented_view(segment_list segments, Pred pred)
+        : segments_(std::move(segments)), pred_(std::move(pred)) {}
+
+    segmented_view(const segmented_view&)     = default;
+    segmented_view(segmented_view&&) noexcept = default;
+    ~segmented_view()                         = default;
+
+    // lambdas with captures are not assignable, so the predicate is re-constructed.
+    auto operator=(const segmented_view& that) -> segmented_view& {
+        if (this != &that) {
+            segments_ = that.segments_;
+            pred_.emplace(*that.pred_);
+        }
+        return *this;
+    }
+
+    auto operator=(segmented_view&& that) noexcept -> segmented_view& {
+        if (this != &that) {
+            segments_ = std::move(that.segments_);
+            pred_.emplace(std::move(*that.pred_));
+        }
+        return *this;
+    }
+
+    [[nodiscard]] auto begin() const noexcept -> iterator { return iterator{ this, 0 }; }
+    [[nodiscard]] auto end() const noexcept -> std::default_sentinel_t { return {}; }
+
+    /**
+     * @brief Call a function with each entity, in chunks of `grain` in parallel.
+     *
+     */
+    template <typename Func>
+    void par_each(Func&& func, const std::size_t grain = default_grain) const {
+        struct chunk {
+            std::size_t segment;
+            std::size_t first;
+            std::size_t last;
+        };
+
+        const auto step = grain ? grain : 1;
+        vector<chunk> chunks;
+        for (std::size_t i = 0; i < segments_.size(); ++i) {
+            const auto size = segments_[i].first->size();
+            for (std::size_t first = 0; first < size; first += step) {
+                chunks.push_back({ i, first, std::min(first + step, size) });
+            }
+        }
+
+        internal::parallel_for(chunks.size(), [this, &func, &chunks](const std::size_t i) {
+            const auto& [segment, first, last] = chunks[i];
+            const auto& [entities, tag]        = segments_[segment];
+            for (auto pos = first; pos < last; ++pos) {
+                if ((*pred_)((*entities)[pos], tag)) {
+                    func((*entities)[pos]);
+                }
+            }
+        });
+    }
+
+private:
+    segment_list segments_;
+    std::optional<Pred> pred_;
+};
+
+} // namespace atom::ecs::internal
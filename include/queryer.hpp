@@ -1,12 +1,22 @@
 #pragma once
+#include <algorithm>
+#include <array>
 #include <exception>
+#include <limits>
 #include <ranges>
 #include <stdexcept>
+#include <type_traits>
 #include <core/langdef.hpp>
 #include <memory/pool.hpp>
-#include <memory/storage.hpp>
+#include "archetype.hpp"
 #include "ecs.hpp"
+#include "query.hpp"
 #include "reflection.hpp"
+#include "resource_table.hpp"
+#include "signature.hpp"
+#include "sparse_set.hpp"
+#include "transient_collection.hpp"
+#include "view.hpp"
 #include "world.hpp"
 
 namespace atom::ecs {
@@ -16,14 +26,37 @@ namespace atom::ecs {
  */
 class queryer {
 public:
-    explicit queryer(::atom::ecs::world* const world) noexcept : world_(world) {}
+    /**
+     * @brief Queryer that sees every change so far as new, its changes get a new tick.
+     *
+     */
+    explicit queryer(::atom::ecs::world* const world) noexcept
+        : world_(world), since_(0), tick_(world->advance_tick()) {
+        // older than every stored tick, which are clamped to `max_tick_age` each
+        // `tick_clamp_interval`, so this still holds after the ticks wrap.
+        since_ = tick_ - max_tick_age - tick_clamp_interval - 1;
+    }
+
+    /**
+     * @brief Queryer of a system run.
+     *
+     * @param since Tick of the previous run, changes stamped after it are new.
+     * @param tick Tick of this run, components got mutably are stamped with it.
+     */
+    queryer(
+        ::atom::ecs::world* const world, const component::tick_t since, const component::tick_t tick
+    ) noexcept
+        : world_(world), since_(since), tick_(tick) {}
 
     queryer(const queryer&) noexcept            = default;
     queryer& operator=(const queryer&) noexcept = default;
 
-    queryer(queryer&& that) noexcept : world_(std::exchange(that.world_, nullptr)) {}
+    queryer(queryer&& that) noexcept
+        : world_(std::exchange(that.world_, nullptr)), since_(that.since_), tick_(that.tick_) {}
     queryer& operator=(queryer&& that) noexcept {
         world_ = std::exchange(that.world_, nullptr);
+        since_ = that.since_;
+        tick_  = that.tick_;
         return *this;
     }
 
@@ -32,25 +65,104 @@ public:
     /**
      * @brief Query all entities has all of these components.
      *
+     * Iterates the component with the fewest entities and probes the others.
+     *
      * @tparam Tys Component types.
      * @return Entity id in a `std::vector`.
      */
     template <typename... Components>
     [[nodiscard]] auto query_all_of() const {
-        auto filt = [this](const entity::id_t entity) { return all_of<Components...>(entity); };
-        return std::views::filter(world_->living_entities_, filt);
+        if constexpr (sizeof...(Components) == 0) {
+            return std::views::all(world_->entities_);
+        }
+        else {
+            constexpr auto count = sizeof...(Components);
+            const std::array<internal::component_probe, count> probes{ probe<Components>()... };
+
+            std::size_t driver = count;
+            std::size_t least  = (std::numeric_limits<std::size_t>::max)();
+            for (std::size_t i = 0; i < count; ++i) {
+                if (!probes[i].tables) {
+                    if (const auto candidates = probes[i].candidates(); candidates < least) {
+                        least  = candidates;
+                        driver = i;
+                    }
+                }
+            }
+
+            internal::segment_list segments;
+            if constexpr ((is_table_component_v<Components> || ...)) {
+                // tables that have all of the table components, no need to probe them.
+                std::size_t candidates{};
+                internal::segment_list tables;
+                for (const auto& table : world_->archetypes_.archetypes()) {
+                    const auto matches = std::ranges::all_of(probes, [&table](const auto& probe) {
+                        return !probe.tables || table->contains(probe.identity);
+                    });
+                    if (table->size() && matches) {
+                        candidates += table->size();
+                        tables.emplace_back(&table->entities(), count);
+                    }
+                }
+                if (candidates < least) {
+                    driver   = count;
+                    segments = std::move(tables);
+                }
+            }
+            if (driver != count) {
+                probes[driver].segments(segments, driver);
+            }
+
+            auto pred = [world = world_, probes](const entity::id_t entity, const std::size_t tag) {
+                if (!world->entities_.contains(entity)) {
+                    return false;
+                }
+                const entity::index_t index = entity >> magic_32;
+                for (std::size_t i = 0; i < count; ++i) {
+                    const bool satisfied = i == tag || (tag == count && probes[i].tables);
+                    if (!satisfied && !probes[i].contains(index)) {
+                        return false;
+                    }
+                }
+                return true;
+            };
+            return internal::segmented_view{ std::move(segments), std::move(pred) };
+        }
     }
 
     /**
      * @brief Query all entities has any of these components.
      *
+     * Iterates the union of the components, each entity appears once.
+     *
      * @tparam Tys Component types.
      * @return Entity id in a `std::vector`.
      */
     template <typename... Components>
     [[nodiscard]] auto query_any_of() const {
-        auto filt = [this](const entity::id_t entity) { return any_of<Components...>(entity); };
-        return std::views::filter(world_->living_entities_, filt);
+        const std::array<internal::component_probe, sizeof...(Components)> probes{
+            probe<Components>()...
+        };
+
+        internal::segment_list segments;
+        for (std::size_t i = 0; i < probes.size(); ++i) {
+            probes[i].segments(segments, i);
+        }
+
+        auto pred = [world = world_, probes](const entity::id_t entity, const std::size_t tag) {
+            if (!world->entities_.contains(entity)) {
+                return false;
+            }
+            // already visited in the former components.
+            const entity::index_t index = entity >> magic_32;
+            for (std::size_t i = 0; i < tag; ++i) {
+                if (probes[i].contains(index)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        return internal::segmented_view{ std::move(segments), std::move(pred) };
     }
 
     /**
@@ -61,8 +173,84 @@ public:
      */
     template <typename... Components>
     [[nodiscard]] auto query_non_of() const {
-        auto filt = [this](const entity::id_t entity) { return non_of<Components...>(entity); };
-        return std::views::filter(world_->living_entities_, filt);
+        // the signatures of the whole world are scanned at once, see `mask_filter`.
+        static const auto exclude = signature::of<Components...>();
+        vector<entity::index_t> indices;
+        world_->entities_.select(signature{}, exclude, indices);
+
+        const auto* entities = &world_->entities_;
+        return std::move(indices) |
+               std::views::transform([entities](const entity::index_t index) {
+                   return entities->id_of(index);
+               });
+    }
+
+    /**
+     * @brief Make a view of all entities has all of these components.
+     *
+     * Storages are resolved once, components are handed out while iterating:
+     * `view<A, const B>().each([](entity::id_t entity, A& a, const B& b) {})`, or
+     * `for (auto [entity, a, b] : view<A, const B>())`.
+     *
+     * @tparam Components Component types, could be `const`.
+     */
+    template <typename... Components>
+    [[nodiscard]] auto view() const -> component_view<Components...> {
+        static_assert(sizeof...(Components) != 0);
+        return component_view<Components...>{ &world_->entities_,
+                                              &world_->archetypes_,
+                                              std::tuple{ view_storage<Components>()... },
+                                              since_,
+                                              tick_ };
+    }
+
+    /**
+     * @brief Entities whose component was removed, or which were killed with it, since the
+     * previous run.
+     *
+     * Removals of a type are only logged once it is tracked, see `world::track_removals`. A system
+     * added by `world::add_system` tracks the components it reads. Logs are kept for the current
+     * and the previous update. Removals made while iterating are not visited.
+     *
+     * @tparam Component Component type.
+     * @return Entity ids, they could be dead already.
+     */
+    template <typename Component>
+    [[nodiscard]] auto removed() const {
+        const auto identity = component_index<Component>();
+        world_->track_removals(identity);
+        // indexed, so that removals logged meanwhile don't invalidate it.
+        const auto* removals = &world_->removed_[identity];
+        return std::views::iota(std::size_t{}, removals->size()) |
+               std::views::filter([removals, since = since_, tick = tick_](const std::size_t i) {
+                   const auto removed = (*removals)[i].second;
+                   return is_newer(removed, since) && !is_newer(removed, tick);
+               }) |
+               std::views::transform([removals](const std::size_t i) {
+                   return (*removals)[i].first;
+               });
+    }
+
+    /**
+     * @brief Tick of the previous run of the system, changes stamped after it are new.
+     *
+     */
+    [[nodiscard]] auto last_run() const noexcept -> component::tick_t { return since_; }
+
+    /**
+     * @brief Tick of this run of the system.
+     *
+     */
+    [[nodiscard]] auto change_tick() const noexcept -> component::tick_t { return tick_; }
+
+    /**
+     * @brief Register a query whose matching entities are maintained incrementally.
+     *
+     * @see world::make_query
+     */
+    template <typename... Filters>
+    auto make_query() -> cached_query& {
+        return world_->make_query<Filters...>();
     }
 
     /**
@@ -74,7 +262,8 @@ public:
      */
     template <typename... Components>
     [[nodiscard]] auto all_of(const entity::id_t entity) const -> bool {
-        return (has<Components>(entity) && ...);
+        static const auto mask = signature::of<Components...>();
+        return signature_of(entity).contains(mask);
     }
 
     /**
@@ -86,7 +275,8 @@ public:
      */
     template <typename... Components>
     [[nodiscard]] auto any_of(const entity::id_t entity) const -> bool {
-        return (has<Components>(entity) || ...);
+        static const auto mask = signature::of<Components...>();
+        return signature_of(entity).intersects(mask);
     }
 
     /**
@@ -107,7 +297,7 @@ public:
      * @warning Please do not call this function if you have other solutions.
      */
     [[nodiscard]] auto exist(const entity::id_t entity) const noexcept -> bool {
-        return world_->living_entities_.find(entity) != world_->living_entities_.cend();
+        return world_->entities_.contains(entity);
     }
 
     [[nodiscard]] auto index(const entity::id_t entity) const noexcept -> entity::index_t {
@@ -123,46 +313,37 @@ public:
      * @brief Get a object of a entity
      *
      * This function assume that you have already assured this entity has this kind of
-     * component.
+     * component. In a non-exclusive system a component attached in the same run is not there
+     * until the next sync point, see `command`.
+     *
+     * The component is stamped as changed, so only systems that write it should call this. Reading
+     * is `get<const Component>`, which doesn't stamp and could run alongside other readers.
      *
      * @tparam Ty Object type
      * @param entity entity id
-     * @return Constant reference of the object
+     * @return Reference of the object
      */
-    template <typename Component, auto hash = utils::hash_of<Component>()>
+    template <typename Component>
+    requires(!std::is_const_v<Component>)
     [[nodiscard]] auto get(const entity::id_t entity) -> Component& {
-        const auto identity         = component_registry::identity(hash);
         const entity::index_t index = entity >> magic_32;
 
-        // find the tuple
-        auto iter = world_->component_storage_.find(identity);
-        if (iter != world_->component_storage_.end()) [[likely]] {
-            auto& pair                              = *iter;
-            auto& [map, basic_allocator, reflected] = pair.second;
-
-            // get the component in the internal map
-            if (auto iter = map.find(index); iter != map.end()) [[likely]] {
-                auto& pair = *iter;
-
-                // if the component does not refers to a null pointer
-                if (pair.second) [[likely]] {
-                    return *static_cast<Component*>(pair.second);
-                }
-                else [[unlikely]] {
-                    if constexpr (std::is_default_constructible_v<Component>) {
-                        auto* allocator =
-                            static_cast<utils::allocator<Component, utils::synchronized_pool>*>(
-                                basic_allocator
-                            );
-                        Component* ptr = allocator->allocate(1);
-                        ::new (ptr) Component();
-                        pair.second = std::launder(static_cast<Component*>(ptr));
-                        return *ptr;
-                    }
-                    else {
-                        throw std::runtime_error("Couldn't get empty component!");
-                    }
-                }
+        // the component is assumed to be changed, it is stamped with the tick of this run.
+        if constexpr (is_table_component_v<Component>) {
+            const auto identity = component_index<Component>();
+            if (auto* component = world_->archetypes_.find<Component>(index, identity))
+                [[likely]] {
+                world_->archetypes_.ticks_of(index, identity)->changed = tick_;
+                return *component;
+            }
+            else [[unlikely]] {
+                throw std::runtime_error("Couldn't get component not existed!");
+            }
+        }
+        else if (auto* storage = world_->storage_of<Component>()) [[likely]] {
+            if (auto* component = storage->find(index)) [[likely]] {
+                storage->ticks_of(index)->changed = tick_;
+                return *component;
             }
             else [[unlikely]] {
                 throw std::runtime_error("Couldn't get component not existed!");
@@ -173,21 +354,32 @@ public:
         }
     }
 
-    template <typename Component, auto hash = utils::hash_of<Component>()>
+    template <typename Component>
     [[nodiscard]] auto get(const entity::id_t entity) const -> const Component& {
-        const auto identity         = component_registry::identity(hash);
+        using type                  = std::remove_const_t<Component>;
         const entity::index_t index = entity >> magic_32;
 
-        if (auto iter = world_->component_storage_.find(identity);
-            iter != world_->component_storage_.cend()) [[likely]] {
-            auto& [map, allocator, reflected] = iter->second;
-            if (auto iter = map.find(index); iter != map.cend()) [[likely]] {
-                return *static_cast<Component*>(iter->second);
+        if constexpr (is_table_component_v<type>) {
+            if (const auto* component =
+                    world_->archetypes_.find<type>(index, component_index<type>()))
+                [[likely]] {
+                return *component;
+            }
+            else {
+                throw std::runtime_error("Couldn't get not exist component!");
+            }
+        }
+        else if (const auto* storage = world_->storage_of<type>()) [[likely]] {
+            if (const auto* component = storage->find(index)) [[likely]] {
+                return *component;
             }
             else {
                 throw std::runtime_error("Couldn't get not exist component!");
             }
         }
+        else {
+            throw std::runtime_error("Couldn't get component without map!");
+        }
     }
 
     /**
@@ -198,36 +390,88 @@ public:
      * @tparam Ty Type of resource need to find.
      * @return shared_ptr of its initializer.
      */
-    template <typename Resource, auto hash = utils::hash_of<Resource>()>
+    template <typename Resource>
     [[nodiscard]] auto find() const -> Resource* const {
-        const auto identity = resource_registry::identity(hash);
-        if (auto iter = world_->resource_storage_.find(identity);
-            iter != world_->resource_storage_.end()) [[likely]] {
-            utils::basic_storage* basic_storage = (*iter).second;
-            return static_cast<Resource*>(basic_storage->raw());
-        }
-        else {
-            return static_cast<Resource*>(nullptr);
-        }
+        return static_cast<Resource*>(world_->resources_.slot<Resource>().get());
+    }
+
+    /**
+     * @brief Handle of a type of resource for reading.
+     *
+     * The handle could be kept as long as the world lives and reaches the resource without
+     * looking it up.
+     *
+     * @tparam Resource Type of resource.
+     */
+    template <typename Resource>
+    [[nodiscard]] auto resource() const -> res<Resource> {
+        return res<Resource>{ &world_->resources_.slot<Resource>() };
+    }
+
+    /**
+     * @brief Handle of a type of resource for writing, see `resource`.
+     *
+     */
+    template <typename Resource>
+    [[nodiscard]] auto resource_mut() const -> res_mut<Resource> {
+        return res_mut<Resource>{ &world_->resources_.slot<Resource>() };
+    }
+
+    /**
+     * @brief Memory resource for scratch memory of this frame, see `command::frame_resource`.
+     *
+     */
+    [[nodiscard]] auto frame_resource() const noexcept -> std::pmr::memory_resource* {
+        return world_->frame_arena();
+    }
+
+    /**
+     * @brief Events of a type sent in the previous update.
+     *
+     * @tparam Event Event type.
+     */
+    template <typename Event>
+    [[nodiscard]] auto events() const -> event_reader<Event> {
+        return event_reader<Event>{ world_->events_.find<Event>() };
     }
 
     auto current_world() noexcept -> world* { return world_; }
 
 private:
-    template <utils::concepts::pure Component, auto hash = utils::hash_of<Component>()>
-    [[nodiscard]] auto has(const entity::id_t entity) const noexcept -> bool {
-        const auto identity         = component_registry::identity(hash);
-        const entity::index_t index = entity >> magic_32;
-        if (auto iter = world_->component_storage_.find(identity);
-            iter != world_->component_storage_.cend()) [[likely]] {
-            const auto& [map, allocator, reflected] = (*iter).second;
-            return map.contains(index);
+    template <typename Component>
+    [[nodiscard]] auto probe() const -> internal::component_probe {
+        const auto identity = component_index<Component>();
+        if constexpr (is_table_component_v<Component>) {
+            return { nullptr, &world_->archetypes_, identity };
         }
         else {
-            return false;
+            return { world_->storage_of<Component>(), nullptr, identity };
         }
     }
 
+    template <typename Component>
+    [[nodiscard]] auto view_storage() const -> internal::view_storage<Component> {
+        using value_type    = std::remove_const_t<Component>;
+        const auto identity = component_index<value_type>();
+        if constexpr (is_table_component_v<value_type>) {
+            return { &world_->archetypes_, identity };
+        }
+        else {
+            return { world_->storage_of<value_type>(), identity };
+        }
+    }
+
+    [[nodiscard]] auto signature_of(const entity::id_t entity) const noexcept
+        -> const signature& {
+        static const signature empty;
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        return index < world_->entities_.signatures().size()
+                   ? world_->entities_.signature_of(index)
+                   : empty;
+    }
+
     ::atom::ecs::world* world_;
+    component::tick_t since_;
+    component::tick_t tick_;
 };
 } // namespace atom::ecs
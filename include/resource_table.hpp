@@ -0,0 +1,168 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "ecs.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Place of a type of resource in a world, it outlives the resource.
+ *
+ * Small resources are stored in the slot itself, larger ones are allocated.
+ */
+class resource_slot {
+public:
+    constexpr static std::size_t inline_size = 48;
+
+    resource_slot() noexcept = default;
+
+    resource_slot(const resource_slot&)            = delete;
+    resource_slot(resource_slot&&)                 = delete;
+    resource_slot& operator=(const resource_slot&) = delete;
+    resource_slot& operator=(resource_slot&&)      = delete;
+
+    ~resource_slot() noexcept { reset(); }
+
+    /**
+     * @brief Construct the resource, the slot must be empty.
+     *
+     */
+    template <typename Resource, typename... Args>
+    auto emplace(Args&&... args) -> Resource& {
+        if constexpr (fits_inline<Resource>) {
+            auto* value = ::new (static_cast<void*>(buffer_)) Resource(std::forward<Args>(args)...);
+            destroy_    = [](void* value) noexcept { static_cast<Resource*>(value)->~Resource(); };
+            value_      = value;
+            return *value;
+        }
+        else {
+            auto* value = new Resource(std::forward<Args>(args)...);
+            destroy_    = [](void* value) noexcept { delete static_cast<Resource*>(value); };
+            value_      = value;
+            return *value;
+        }
+    }
+
+    /**
+     * @brief Destroy the resource, if any.
+     *
+     */
+    void reset() noexcept {
+        if (value_) {
+            destroy_(std::exchange(value_, nullptr));
+        }
+    }
+
+    /**
+     * @brief Address of the resource.
+     *
+     * @return `nullptr` if there is no resource.
+     */
+    [[nodiscard]] auto get() const noexcept -> void* { return value_; }
+
+private:
+    template <typename Resource>
+    constexpr static bool fits_inline =
+        sizeof(Resource) <= inline_size && alignof(Resource) <= alignof(std::max_align_t);
+
+    void* value_{};
+    void (*destroy_)(void*) noexcept {};
+    alignas(std::max_align_t) std::byte buffer_[inline_size];
+};
+
+/**
+ * @brief Handle of a resource for reading.
+ *
+ * It is bound to the slot of the resource, so reaching the resource is one load. The handle stays
+ * valid when the resource is added or removed later, it is empty while there is no resource. A
+ * default constructed handle is bound to nothing and always empty.
+ *
+ * In the `reads` and `writes` lists of a system it names the resource, see `system_access`.
+ */
+template <typename Resource>
+class res {
+public:
+    res() noexcept = default;
+    explicit res(const resource_slot* slot) noexcept : slot_(slot) {}
+
+    [[nodiscard]] auto get() const noexcept -> const Resource* {
+        return slot_ ? static_cast<const Resource*>(slot_->get()) : nullptr;
+    }
+
+    [[nodiscard]] auto operator*() const noexcept -> const Resource& { return *get(); }
+    [[nodiscard]] auto operator->() const noexcept -> const Resource* { return get(); }
+    [[nodiscard]] explicit operator bool() const noexcept { return get() != nullptr; }
+
+private:
+    const resource_slot* slot_{};
+};
+
+/**
+ * @brief Handle of a resource for writing, see `res`.
+ *
+ */
+template <typename Resource>
+class res_mut {
+public:
+    res_mut() noexcept = default;
+    explicit res_mut(resource_slot* slot) noexcept : slot_(slot) {}
+
+    [[nodiscard]] auto get() const noexcept -> Resource* {
+        return slot_ ? static_cast<Resource*>(slot_->get()) : nullptr;
+    }
+
+    [[nodiscard]] auto operator*() const noexcept -> Resource& { return *get(); }
+    [[nodiscard]] auto operator->() const noexcept -> Resource* { return get(); }
+    [[nodiscard]] explicit operator bool() const noexcept { return get() != nullptr; }
+
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    operator res<Resource>() const noexcept { return res<Resource>{ slot_ }; }
+
+private:
+    resource_slot* slot_{};
+};
+
+/**
+ * @brief Resources of a world, in slots indexed by `resource_index`.
+ *
+ * The slots are made with the table and never move, so handles to them could be taken once and
+ * kept.
+ */
+class resource_table {
+public:
+    /**
+     * @brief Max number of resource types.
+     *
+     */
+    constexpr static std::size_t max_resources = 256;
+
+    resource_table() : slots_(std::make_unique<resource_slot[]>(max_resources)) {}
+
+    template <typename Resource>
+    [[nodiscard]] auto slot() const -> resource_slot& {
+        const auto identity = resource_index<Resource>();
+        if (identity >= max_resources) [[unlikely]] {
+            throw std::runtime_error("Too many resource types!");
+        }
+        return slots_[identity];
+    }
+
+    /**
+     * @brief Destroy all the resources, the slots are kept.
+     *
+     */
+    void clear() noexcept {
+        for (std::size_t i = 0; i < max_resources; ++i) {
+            slots_[i].reset();
+        }
+    }
+
+private:
+    std::unique_ptr<resource_slot[]> slots_;
+};
+
+} // namespace atom::ecs
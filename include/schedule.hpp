@@ -1,6 +1,7 @@
 #pragma once
 #include <memory>
 #include <memory/allocator.hpp>
+#include "executor.hpp"
 #include "memory/pool.hpp"
 #include "thread.hpp"
 
@@ -19,6 +20,12 @@ struct scheduler {
 
     [[nodiscard]] static auto thread_pool() noexcept -> atom::utils::thread_pool&;
 
+    /**
+     * @brief Executor of systems and parallel iteration, one worker less than hardware threads.
+     *
+     */
+    [[nodiscard]] static auto executor() noexcept -> ::atom::ecs::executor&;
+
     template <typename Ty>
     [[nodiscard]] static auto allocate(std::size_t count = 1) {
         return synchronized_pool()->allocate<Ty>(count);
@@ -0,0 +1,107 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "ecs.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Set of component types an entity has, one bit per `component_index`.
+ *
+ * Membership tests of several components at once are a few word-wise ANDs.
+ */
+class signature {
+public:
+    using word_type = std::uint64_t;
+
+    constexpr static std::size_t word_bits  = sizeof(word_type) * 8;
+    constexpr static std::size_t word_count = max_components / word_bits;
+
+    /**
+     * @brief Signature of these component types, `const` ones are the same as the others.
+     *
+     */
+    template <typename... Components>
+    [[nodiscard]] static auto of() -> signature {
+        signature result;
+        (result.set(component_index<std::remove_const_t<Components>>()), ...);
+        return result;
+    }
+
+    void set(const component::id_t id) noexcept {
+        words_[id / word_bits] |= word_type{ 1 } << (id % word_bits);
+    }
+
+    void reset(const component::id_t id) noexcept {
+        words_[id / word_bits] &= ~(word_type{ 1 } << (id % word_bits));
+    }
+
+    void clear() noexcept { words_ = {}; }
+
+    [[nodiscard]] auto test(const component::id_t id) const noexcept -> bool {
+        return (words_[id / word_bits] >> (id % word_bits)) & 1U;
+    }
+
+    /**
+     * @brief Whether all the components of `that` are in this one.
+     *
+     */
+    [[nodiscard]] auto contains(const signature& that) const noexcept -> bool {
+        for (std::size_t i = 0; i < word_count; ++i) {
+            if ((words_[i] & that.words_[i]) != that.words_[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Whether any of the components of `that` is in this one.
+     *
+     */
+    [[nodiscard]] auto intersects(const signature& that) const noexcept -> bool {
+        for (std::size_t i = 0; i < word_count; ++i) {
+            if (words_[i] & that.words_[i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    [[nodiscard]] auto none() const noexcept -> bool {
+        for (const auto word : words_) {
+            if (word) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Call a function with each component id in this signature, in ascending order.
+     *
+     */
+    template <typename Func>
+    void for_each(Func&& func) const {
+        for (std::size_t i = 0; i < word_count; ++i) {
+            for (auto word = words_[i]; word; word &= word - 1) {
+                func(static_cast<component::id_t>(i * word_bits + std::countr_zero(word)));
+            }
+        }
+    }
+
+    [[nodiscard]] auto words() const noexcept -> const std::array<word_type, word_count>& {
+        return words_;
+    }
+
+    [[nodiscard]] friend auto operator==(const signature&, const signature&) noexcept
+        -> bool = default;
+
+private:
+    std::array<word_type, word_count> words_{};
+};
+
+} // namespace atom::ecs
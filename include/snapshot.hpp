@@ -0,0 +1,261 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <reflection.hpp>
+#include "archetype.hpp"
+#include "containers.hpp"
+#include "ecs.hpp"
+#include "resource_table.hpp"
+#include "sparse_set.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Writes and reads a type of component or resource in a world snapshot.
+ *
+ * Specialize it with `static void save(std::ostream&, const Type&)` and
+ * `static auto load(std::istream&) -> Type` for types that are not trivially copyable, or whose
+ * bytes shouldn't be written as they are. See `world::save`.
+ */
+template <typename Type>
+struct snapshot_serializer;
+
+namespace concepts {
+
+template <typename Type>
+concept serialized_snapshot = requires(std::ostream& out, std::istream& in, const Type& value) {
+    snapshot_serializer<Type>::save(out, value);
+    { snapshot_serializer<Type>::load(in) } -> std::same_as<Type>;
+};
+
+/**
+ * @brief Types written as raw blocks of bytes, without a serializer.
+ *
+ */
+template <typename Type>
+concept raw_snapshot = !serialized_snapshot<Type> && std::is_trivially_copyable_v<Type> &&
+                       std::is_default_constructible_v<Type>;
+
+} // namespace concepts
+
+/**
+ * @brief What a snapshot needs to know of a type of component.
+ *
+ * Objects are written as a raw block if `raw`, otherwise through `snapshot_serializer`. Types
+ * that are neither are not `savable` and left out of snapshots, so are serialized table components
+ * that are not nothrow move constructible.
+ */
+struct snapshot_component {
+    std::size_t hash;
+    std::size_t size;
+    bool raw;
+    bool savable;
+    // table components have `traits`, others live in sparse sets.
+    const column_traits* traits;
+    component::id_t (*index)();
+    basic_sparse_set* (*make_storage)();
+    utils::basic_reflected* (*make_reflected)();
+    // packed components of a sparse set.
+    const void* (*packed)(const basic_sparse_set* storage) noexcept;
+    // default construct the components of entities at the end of a sparse set, raw types only.
+    void* (*append)(basic_sparse_set* storage, std::span<const entity::id_t> entities);
+    // serialized types only.
+    void (*save)(std::ostream& out, const void* objects, std::size_t count);
+    // a vector of `count` objects.
+    std::shared_ptr<void> (*load)(std::istream& in, std::size_t count);
+    void (*emplace)(
+        basic_sparse_set* storage, std::span<const entity::id_t> entities, void* values
+    );
+    // move construct the loaded objects into uninitialized memory.
+    void (*place)(void* values, void* destination) noexcept;
+
+    template <typename Component>
+    [[nodiscard]] static auto of() noexcept -> const snapshot_component*;
+};
+
+/**
+ * @brief What a snapshot needs to know of a type of resource, see `snapshot_component`.
+ *
+ */
+struct snapshot_resource {
+    std::size_t hash;
+    bool savable;
+    resource_slot& (*slot)(const resource_table& table);
+    void (*save)(std::ostream& out, const void* resource);
+    // the resource, read before any slot is replaced.
+    std::shared_ptr<void> (*load)(std::istream& in);
+    // replaces the resource in the slot by a loaded one.
+    void (*assign)(resource_slot& slot, void* value);
+
+    template <typename Resource>
+    [[nodiscard]] static auto of() noexcept -> const snapshot_resource*;
+};
+
+namespace internal {
+
+/**
+ * @brief Make a type known to snapshots of this process. Thread safe.
+ *
+ */
+auto enroll(const snapshot_component* type) -> bool;
+auto enroll(const snapshot_resource* type) -> bool;
+
+[[nodiscard]] auto snapshot_components() -> vector<const snapshot_component*>;
+[[nodiscard]] auto snapshot_resources() -> vector<const snapshot_resource*>;
+
+/**
+ * @brief Types are enrolled before `main` by naming these where their storages are made, so a
+ * world of a new process could load a snapshot before it has seen any of them.
+ *
+ */
+template <typename Component>
+inline const bool snapshot_component_enrolled = enroll(snapshot_component::of<Component>());
+
+template <typename Resource>
+inline const bool snapshot_resource_enrolled = enroll(snapshot_resource::of<Resource>());
+
+template <typename Type>
+void save_objects(std::ostream& out, const void* objects, const std::size_t count) {
+    const auto* values = static_cast<const Type*>(objects);
+    for (std::size_t i = 0; i < count; ++i) {
+        snapshot_serializer<Type>::save(out, values[i]);
+    }
+}
+
+template <typename Type>
+auto load_objects(std::istream& in, const std::size_t count) -> std::shared_ptr<void> {
+    auto values = std::make_shared<vector<Type>>();
+    values->reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        values->emplace_back(snapshot_serializer<Type>::load(in));
+    }
+    return values;
+}
+
+} // namespace internal
+
+template <typename Component>
+auto snapshot_component::of() noexcept -> const snapshot_component* {
+    using values_t = vector<Component>;
+
+    constexpr static bool raw        = concepts::raw_snapshot<Component>;
+    constexpr static bool serialized = concepts::serialized_snapshot<Component>;
+    constexpr static bool table      = is_table_component_v<Component>;
+    // loaded objects of tables are moved into their rows, see `place`.
+    constexpr static bool movable    = !table || std::is_nothrow_move_constructible_v<Component>;
+
+    static const snapshot_component type{
+        utils::hash_of<Component>(),
+        sizeof(Component),
+        raw,
+        raw || (serialized && movable),
+        [] {
+            if constexpr (table) {
+                return column_traits::of<Component>();
+            }
+            else {
+                return static_cast<const column_traits*>(nullptr);
+            }
+        }(),
+        &component_index<Component>,
+        []() -> basic_sparse_set* { return new sparse_set<Component>(); },
+        []() -> utils::basic_reflected* { return new utils::reflected<Component>(); },
+        [](const basic_sparse_set* storage) noexcept -> const void* {
+            return static_cast<const sparse_set<Component>*>(storage)->components().data();
+        },
+        [](basic_sparse_set* storage, std::span<const entity::id_t> entities) -> void* {
+            if constexpr (raw) {
+                return static_cast<sparse_set<Component>*>(storage)->append(entities);
+            }
+            else {
+                return nullptr;
+            }
+        },
+        [](std::ostream& out, const void* objects, std::size_t count) {
+            if constexpr (serialized) {
+                internal::save_objects<Component>(out, objects, count);
+            }
+        },
+        [](std::istream& in, std::size_t count) -> std::shared_ptr<void> {
+            if constexpr (serialized) {
+                return internal::load_objects<Component>(in, count);
+            }
+            else {
+                return nullptr;
+            }
+        },
+        [](basic_sparse_set* storage, std::span<const entity::id_t> entities, void* values) {
+            if constexpr (serialized) {
+                auto* set     = static_cast<sparse_set<Component>*>(storage);
+                auto& objects = *static_cast<values_t*>(values);
+                set->reserve(entities.size());
+                for (std::size_t i = 0; i < entities.size(); ++i) {
+                    set->emplace(entities[i], std::move(objects[i]));
+                }
+            }
+        },
+        [](void* values, void* destination) noexcept {
+            if constexpr (serialized && movable) {
+                auto& objects = *static_cast<values_t*>(values);
+                auto* target  = static_cast<Component*>(destination);
+                for (auto& object : objects) {
+                    ::new (static_cast<void*>(target++)) Component(std::move(object));
+                }
+            }
+        }
+    };
+    return &type;
+}
+
+template <typename Resource>
+auto snapshot_resource::of() noexcept -> const snapshot_resource* {
+    constexpr static bool raw        = concepts::raw_snapshot<Resource>;
+    constexpr static bool serialized = concepts::serialized_snapshot<Resource>;
+
+    static const snapshot_resource type{
+        utils::hash_of<Resource>(),
+        raw || serialized,
+        [](const resource_table& table) -> resource_slot& { return table.slot<Resource>(); },
+        [](std::ostream& out, const void* resource) {
+            if constexpr (serialized) {
+                snapshot_serializer<Resource>::save(out, *static_cast<const Resource*>(resource));
+            }
+            else if constexpr (raw) {
+                out.write(static_cast<const char*>(resource), sizeof(Resource));
+            }
+        },
+        [](std::istream& in) -> std::shared_ptr<void> {
+            if constexpr (serialized) {
+                return std::make_shared<Resource>(snapshot_serializer<Resource>::load(in));
+            }
+            else if constexpr (raw) {
+                auto value = std::make_shared<Resource>();
+                if (!in.read(reinterpret_cast<char*>(value.get()), sizeof(Resource))) {
+                    throw std::runtime_error("Broken world snapshot!");
+                }
+                return value;
+            }
+            else {
+                return nullptr;
+            }
+        },
+        [](resource_slot& slot, void* value) {
+            if constexpr (raw || serialized) {
+                slot.reset();
+                slot.emplace<Resource>(std::move(*static_cast<Resource*>(value)));
+            }
+        }
+    };
+    return &type;
+}
+
+} // namespace atom::ecs
@@ -0,0 +1,365 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <utility>
+#include <core.hpp>
+#include "component_allocator.hpp"
+#include "containers.hpp"
+#include "ecs.hpp"
+
+namespace atom::ecs {
+
+/**
+ * @brief Type-erased part of a component storage.
+ *
+ * Maps an entity index to a slot in the packed arrays. The sparse index is paged, so a storage
+ * only pays for the ranges of indices it has really seen.
+ */
+class basic_sparse_set {
+public:
+    using slot_type = std::uint32_t;
+
+    constexpr static std::size_t page_size = utils::k_default_page_size;
+    constexpr static slot_type npos        = (std::numeric_limits<slot_type>::max)();
+
+    /**
+     * @param resource Memory resource of the packed arrays.
+     */
+    explicit basic_sparse_set(std::pmr::memory_resource* const resource)
+        : packed_(resource), ticks_(resource) {}
+
+    basic_sparse_set(const basic_sparse_set&)            = delete;
+    basic_sparse_set(basic_sparse_set&&)                 = delete;
+    basic_sparse_set& operator=(const basic_sparse_set&) = delete;
+    basic_sparse_set& operator=(basic_sparse_set&&)      = delete;
+    virtual ~basic_sparse_set()                          = default;
+
+    /**
+     * @brief Slot of an entity in the packed arrays.
+     *
+     * @return `npos` if the entity is not in this storage.
+     */
+    [[nodiscard]] auto slot(const entity::index_t index) const noexcept -> slot_type {
+        const auto page = index / page_size;
+        if (page < sparse_.size() && sparse_[page]) [[likely]] {
+            return sparse_[page][index % page_size];
+        }
+        return npos;
+    }
+
+    [[nodiscard]] auto contains(const entity::index_t index) const noexcept -> bool {
+        return slot(index) != npos;
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return packed_.size(); }
+
+    [[nodiscard]] auto empty() const noexcept -> bool { return packed_.empty(); }
+
+    /**
+     * @brief Entity ids in the same order as the packed components.
+     *
+     */
+    [[nodiscard]] auto entities() const noexcept -> const vector<entity::id_t>& { return packed_; }
+
+    /**
+     * @brief Change ticks in the same order as the packed components.
+     *
+     */
+    [[nodiscard]] auto ticks() noexcept -> vector<component_ticks>& { return ticks_; }
+
+    [[nodiscard]] auto ticks() const noexcept -> const vector<component_ticks>& { return ticks_; }
+
+    /**
+     * @brief Change ticks of the component of an entity.
+     *
+     * @return `nullptr` if the entity is not in this storage.
+     */
+    [[nodiscard]] auto ticks_of(const entity::index_t index) noexcept -> component_ticks* {
+        const auto slot = basic_sparse_set::slot(index);
+        return slot != npos ? &ticks_[slot] : nullptr;
+    }
+
+    [[nodiscard]] auto begin() const noexcept { return packed_.cbegin(); }
+    [[nodiscard]] auto end() const noexcept { return packed_.cend(); }
+
+    /**
+     * @brief Destroy the component of an entity, the last component will be moved into its slot.
+     *
+     */
+    virtual void erase(entity::index_t index) = 0;
+
+    /**
+     * @brief Destroy the components of several entities.
+     *
+     * Storages may sweep themselves once instead of moving a component per entity.
+     */
+    virtual void erase(const std::span<const entity::index_t> indices) {
+        for (const auto index : indices) {
+            erase(index);
+        }
+    }
+
+    /**
+     * @brief Destroy all the components.
+     *
+     */
+    virtual void clear() = 0;
+
+protected:
+    void reserve_packed(const std::size_t capacity) {
+        packed_.reserve(capacity);
+        ticks_.reserve(capacity);
+    }
+
+    /**
+     * @brief Make room for `count` more entities and the page of `index`.
+     *
+     * Then `push_back` of entities on that page doesn't allocate, so it can't throw.
+     */
+    void prepare(const entity::index_t index, const std::size_t count = 1) {
+        make_room(packed_, count);
+        make_room(ticks_, count);
+        assure_page(index / page_size);
+    }
+
+    auto push_back(const entity::id_t entity) -> slot_type {
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        const auto slot  = static_cast<slot_type>(packed_.size());
+        packed_.emplace_back(entity);
+        ticks_.emplace_back();
+        assure_page(index / page_size)[index % page_size] = slot;
+        return slot;
+    }
+
+    void swap_and_pop(const entity::index_t index, const slot_type slot) {
+        const auto back       = packed_.back();
+        const auto back_index = static_cast<entity::index_t>(back >> magic_32);
+        packed_[slot]         = back;
+        ticks_[slot]          = ticks_.back();
+        sparse_[back_index / page_size][back_index % page_size] = slot;
+        sparse_[index / page_size][index % page_size]           = npos;
+        packed_.pop_back();
+        ticks_.pop_back();
+    }
+
+    /**
+     * @brief Unlink entities without moving anything, leaving holes in the packed array.
+     *
+     * @return Number of entities unlinked.
+     */
+    auto punch(const std::span<const entity::index_t> indices) noexcept -> std::size_t {
+        std::size_t count{};
+        for (const auto index : indices) {
+            if (const auto slot = basic_sparse_set::slot(index); slot != npos) {
+                sparse_[index / page_size][index % page_size] = npos;
+                packed_[slot]                                 = tombstone;
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Close the holes left by `punch`, keeping the order of the rest.
+     *
+     * @param relocate Called with `(to, from)` for each slot that has to move.
+     * @return New size of the packed array.
+     */
+    template <typename Relocate>
+    auto compact(Relocate&& relocate) -> std::size_t {
+        slot_type to{};
+        for (slot_type from = 0; from < packed_.size(); ++from) {
+            const auto entity = packed_[from];
+            if (entity == tombstone) {
+                continue;
+            }
+            if (to != from) {
+                const auto index = static_cast<entity::index_t>(entity >> magic_32);
+                packed_[to]      = entity;
+                ticks_[to]       = ticks_[from];
+                sparse_[index / page_size][index % page_size] = to;
+                relocate(to, from);
+            }
+            ++to;
+        }
+        packed_.resize(to);
+        ticks_.resize(to);
+        return to;
+    }
+
+    void reset() noexcept {
+        sparse_.clear();
+        packed_.clear();
+        ticks_.clear();
+    }
+
+private:
+    // index 0 is never handed out, so no living entity has this id.
+    constexpr static entity::id_t tombstone = 0;
+
+    template <typename Vector>
+    static void make_room(Vector& array, const std::size_t count) {
+        if (array.capacity() - array.size() < count) {
+            array.reserve((std::max)(array.size() + count, array.capacity() * 2));
+        }
+    }
+
+    auto assure_page(const std::size_t page) -> slot_type* {
+        if (page >= sparse_.size()) [[unlikely]] {
+            sparse_.resize(page + 1);
+        }
+        if (!sparse_[page]) [[unlikely]] {
+            sparse_[page] = std::make_unique<slot_type[]>(page_size);
+            std::fill_n(sparse_[page].get(), page_size, npos);
+        }
+        return sparse_[page].get();
+    }
+
+    vector<std::unique_ptr<slot_type[]>> sparse_;
+    vector<entity::id_t> packed_;
+    vector<component_ticks> ticks_;
+};
+
+/**
+ * @brief Packed storage of a type of component.
+ *
+ * Components are stored contiguously next to their entity ids, so iterating a storage walks two
+ * plain arrays.
+ *
+ * @tparam Component Component type.
+ */
+template <typename Component>
+class sparse_set final : public basic_sparse_set {
+public:
+    using value_type = Component;
+
+    sparse_set()
+        : basic_sparse_set(component_resource<Component>()),
+          components_(component_resource<Component>()) {}
+
+    sparse_set(const sparse_set&)            = delete;
+    sparse_set(sparse_set&&)                 = delete;
+    sparse_set& operator=(const sparse_set&) = delete;
+    sparse_set& operator=(sparse_set&&)      = delete;
+    ~sparse_set() override                   = default;
+
+    /**
+     * @brief Construct a component for an entity.
+     *
+     * If the entity already has this component, the existing one will be returned untouched.
+     */
+    template <typename... Args>
+    auto emplace(const entity::id_t entity, Args&&... args) -> Component& {
+        const auto index = static_cast<entity::index_t>(entity >> magic_32);
+        if (const auto slot = basic_sparse_set::slot(index); slot != npos) [[unlikely]] {
+            return components_[slot];
+        }
+
+        // everything that could throw comes before the component, so the arrays stay aligned.
+        prepare(index);
+        auto& component = components_.emplace_back(std::forward<Args>(args)...);
+        push_back(entity);
+        return component;
+    }
+
+    /**
+     * @brief Get the component of an entity.
+     *
+     * This function assume that the entity is in this storage.
+     */
+    [[nodiscard]] auto get(const entity::index_t index) noexcept -> Component& {
+        return components_[slot(index)];
+    }
+
+    [[nodiscard]] auto get(const entity::index_t index) const noexcept -> const Component& {
+        return components_[slot(index)];
+    }
+
+    [[nodiscard]] auto find(const entity::index_t index) noexcept -> Component* {
+        const auto slot = basic_sparse_set::slot(index);
+        return slot != npos ? &components_[slot] : nullptr;
+    }
+
+    [[nodiscard]] auto find(const entity::index_t index) const noexcept -> const Component* {
+        const auto slot = basic_sparse_set::slot(index);
+        return slot != npos ? &components_[slot] : nullptr;
+    }
+
+    /**
+     * @brief Make room for `count` more components.
+     *
+     */
+    void reserve(const std::size_t count) {
+        const auto capacity = size() + count;
+        components_.reserve(capacity);
+        reserve_packed(capacity);
+    }
+
+    /**
+     * @brief Default construct the components of entities that are not in this storage yet.
+     *
+     * @return The first of the new components, they are contiguous.
+     */
+    auto append(const std::span<const entity::id_t> entities) -> Component* {
+        reserve(entities.size());
+        for (const auto entity : entities) {
+            prepare(static_cast<entity::index_t>(entity >> magic_32), 0);
+        }
+        const auto first = components_.size();
+        components_.resize(first + entities.size());
+        for (const auto entity : entities) {
+            push_back(entity);
+        }
+        return components_.data() + first;
+    }
+
+    [[nodiscard]] auto components() noexcept -> vector<Component>& { return components_; }
+
+    [[nodiscard]] auto components() const noexcept -> const vector<Component>& {
+        return components_;
+    }
+
+    void erase(const entity::index_t index) override {
+        const auto slot = basic_sparse_set::slot(index);
+        if (slot == npos) [[unlikely]] {
+            return;
+        }
+
+        if (const auto last = components_.size() - 1; slot != last) {
+            components_[slot] = std::move(components_[last]);
+        }
+        components_.pop_back();
+        swap_and_pop(index, slot);
+    }
+
+    void erase(const std::span<const entity::index_t> indices) override {
+        // swapping the last one in is cheaper, until a good part of the storage goes.
+        if (indices.size() * sweep_ratio < size()) {
+            basic_sparse_set::erase(indices);
+            return;
+        }
+
+        if (punch(indices)) {
+            const auto size = compact([this](const slot_type to, const slot_type from) {
+                components_[to] = std::move(components_[from]);
+            });
+            components_.erase(components_.begin() + size, components_.end());
+        }
+    }
+
+    void clear() override {
+        components_.clear();
+        reset();
+    }
+
+private:
+    constexpr static std::size_t sweep_ratio = 4;
+
+    vector<Component> components_;
+};
+
+} // namespace atom::ecs
@@ -0,0 +1,330 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "command_buffer.hpp"
+#include "containers.hpp"
+#include "ecs.hpp"
+#include "resource_table.hpp"
+#include "schedule.hpp"
+#include "signature.hpp"
+
+namespace atom::ecs {
+
+namespace internal {
+
+template <typename Type>
+struct access_item {
+    static void collect(signature& components, vector<resource::id_t>&) {
+        components.set(component_index<std::remove_const_t<Type>>());
+    }
+};
+
+template <typename Resource>
+struct access_item<res<Resource>> {
+    static void collect(signature&, vector<resource::id_t>& resources) {
+        resources.emplace_back(resource_index<std::remove_const_t<Resource>>());
+    }
+};
+
+template <typename Resource>
+struct access_item<res_mut<Resource>> : access_item<res<Resource>> {};
+
+template <typename List>
+struct access_list;
+
+template <template <typename...> typename List, typename... Types>
+struct access_list<List<Types...>> {
+    static void collect(signature& components, vector<resource::id_t>& resources) {
+        (access_item<std::remove_const_t<Types>>::collect(components, resources), ...);
+    }
+};
+
+} // namespace internal
+
+/**
+ * @brief What a system reads and writes.
+ *
+ * Systems without a declaration are exclusive, they conflict with every other system.
+ */
+struct system_access {
+    signature reads;
+    signature writes;
+    vector<resource::id_t> resource_reads;
+    vector<resource::id_t> resource_writes;
+    bool exclusive = true;
+
+    /**
+     * @brief Access declared by `Sys::reads` and `Sys::writes`.
+     *
+     * Both are type lists such as `std::tuple<position, const velocity, res<timer>>`, a component
+     * is named by its type and a resource by `res<Resource>` or `res_mut<Resource>`. Declaring
+     * either of them makes the system non-exclusive, its structural changes are deferred then,
+     * see `system_graph`.
+     */
+    template <typename Sys>
+    [[nodiscard]] static auto of() -> system_access {
+        system_access access;
+        if constexpr (requires { typename Sys::reads; }) {
+            access.exclusive = false;
+            internal::access_list<typename Sys::reads>::collect(
+                access.reads, access.resource_reads
+            );
+        }
+        if constexpr (requires { typename Sys::writes; }) {
+            access.exclusive = false;
+            internal::access_list<typename Sys::writes>::collect(
+                access.writes, access.resource_writes
+            );
+        }
+        return access;
+    }
+
+    /**
+     * @brief Whether two systems must not run at the same time.
+     *
+     */
+    [[nodiscard]] auto conflicts(const system_access& that) const noexcept -> bool {
+        if (exclusive || that.exclusive) {
+            return true;
+        }
+
+        const auto overlaps = [](const auto& lhs, const auto& rhs) {
+            return std::ranges::any_of(lhs, [&rhs](const auto id) {
+                return std::ranges::find(rhs, id) != rhs.end();
+            });
+        };
+        return writes.intersects(that.reads) || writes.intersects(that.writes) ||
+               that.writes.intersects(reads) || overlaps(resource_writes, that.resource_reads) ||
+               overlaps(resource_writes, that.resource_writes) ||
+               overlaps(that.resource_writes, resource_reads);
+    }
+};
+
+/**
+ * @brief Systems of a stage, run as a dependency graph.
+ *
+ * Systems are ordered by priority, higher first, then by the order they were added. A system
+ * depends on every earlier system it conflicts with and starts as soon as those are done, systems
+ * that don't conflict run at the same time on the executor. Systems with `early_main_thread` or
+ * `late_main_thread` priority run on the calling thread. The graph is rebuilt when systems are
+ * added.
+ *
+ * Non-exclusive systems record the changes made through their command into a command buffer of
+ * their own, see `command`, the chunks of their parallel loops into buffers appended to it. The
+ * buffers are applied in the order of the systems at the sync points: before an exclusive system
+ * and at the end of the run. So the result doesn't depend on which system finished first.
+ *
+ * Each run of a system gets a new tick of the world, its changes are stamped with it. Its
+ * queryer sees the changes made since its previous run, see `component_view::changed`.
+ *
+ * @tparam Command `ecs::command`, a parameter so that it only has to be complete where the graph
+ * runs.
+ * @tparam Queryer `ecs::queryer`, likewise.
+ * @tparam Args Arguments besides `command&` and `queryer&`.
+ */
+template <typename Command, typename Queryer, typename... Args>
+class system_graph {
+public:
+    using function_type = void (*)(Command&, Queryer&, Args...);
+
+    void add(function_type func, const int priority, bool main_thread, system_access access) {
+        nodes_.push_back({ func, priority, main_thread, std::move(access), {}, 0, {}, 0 });
+        dirty_ = true;
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return nodes_.size(); }
+    [[nodiscard]] auto empty() const noexcept -> bool { return nodes_.empty(); }
+
+    /**
+     * @brief Run all the systems and return when all of them are done.
+     *
+     * The first exception thrown by a system is rethrown after the others are done.
+     *
+     * @param queryer Queryer of the world the systems run in.
+     */
+    void run(Queryer& queryer, Args... args) {
+        if (dirty_) [[unlikely]] {
+            build();
+        }
+        if (nodes_.empty()) {
+            return;
+        }
+
+#ifndef ATOM_SINGLE_THREAD
+        auto state = std::make_shared<frame>(this, queryer, args...);
+        for (std::uint32_t i = 0; i < nodes_.size(); ++i) {
+            if (!nodes_[i].predecessors) {
+                start(state, i);
+            }
+        }
+
+        // the calling thread runs the main thread systems, and helps with the others until the
+        // executor has nothing left to take.
+        auto& executor = scheduler::executor();
+        std::unique_lock lock{ state->mutex };
+        while (state->done != nodes_.size()) {
+            if (!state->main_ready.empty()) {
+                const auto index = state->main_ready.back();
+                state->main_ready.pop_back();
+                lock.unlock();
+                execute(state, index);
+                lock.lock();
+                continue;
+            }
+
+            lock.unlock();
+            const bool helped = executor.try_run_one();
+            lock.lock();
+            if (!helped && state->done != nodes_.size() && state->main_ready.empty()) {
+                state->cv.wait(lock);
+            }
+        }
+        apply_buffers();
+        if (state->exception) {
+            std::rethrow_exception(state->exception);
+        }
+#else
+        for (auto& node : nodes_) {
+            if (node.access.exclusive) {
+                apply_buffers();
+            }
+            invoke(node, queryer, args...);
+        }
+        apply_buffers();
+#endif
+    }
+
+    /**
+     * @brief Clamp the tick of the last run of each system, see `clamp_tick`.
+     *
+     */
+    void clamp_ticks(const component::tick_t current) noexcept {
+        for (auto& node : nodes_) {
+            node.last_run = clamp_tick(node.last_run, current);
+        }
+    }
+
+private:
+    struct node {
+        function_type func;
+        int priority;
+        bool main_thread;
+        system_access access;
+        vector<std::uint32_t> successors;
+        std::uint32_t predecessors;
+        command_buffer buffer;
+        component::tick_t last_run;
+    };
+
+    // state of a run, shared with the pool tasks so that it outlives the last of them.
+    struct frame {
+        frame(system_graph* graph, Queryer& queryer, Args... args)
+            : graph(graph), queryer(&queryer), args(args...),
+              remaining(std::make_unique<std::atomic<std::uint32_t>[]>(graph->nodes_.size())) {
+            for (std::size_t i = 0; i < graph->nodes_.size(); ++i) {
+                remaining[i].store(graph->nodes_[i].predecessors, std::memory_order_relaxed);
+            }
+        }
+
+        system_graph* graph;
+        Queryer* queryer;
+        std::tuple<Args...> args;
+        std::unique_ptr<std::atomic<std::uint32_t>[]> remaining;
+        std::size_t done{};
+        vector<std::uint32_t> main_ready;
+        std::exception_ptr exception;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    static void start(const std::shared_ptr<frame>& state, const std::uint32_t index) {
+        if (state->graph->nodes_[index].main_thread) {
+            std::lock_guard guard{ state->mutex };
+            state->main_ready.emplace_back(index);
+            state->cv.notify_all();
+        }
+        else {
+            scheduler::executor().submit([state, index] { execute(state, index); });
+        }
+    }
+
+    static void execute(const std::shared_ptr<frame>& state, const std::uint32_t index) {
+        auto& node = state->graph->nodes_[index];
+        try {
+            // an exclusive system runs alone, everything before it is done.
+            if (node.access.exclusive) {
+                state->graph->apply_buffers();
+            }
+            std::apply(
+                [&](auto&... args) { invoke(node, *state->queryer, args...); }, state->args
+            );
+        }
+        catch (...) {
+            std::lock_guard guard{ state->mutex };
+            if (!state->exception) {
+                state->exception = std::current_exception();
+            }
+        }
+
+        for (const auto next : node.successors) {
+            if (state->remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                start(state, next);
+            }
+        }
+
+        std::lock_guard guard{ state->mutex };
+        if (++state->done == state->graph->nodes_.size()) {
+            state->cv.notify_all();
+        }
+    }
+
+    static void invoke(node& node, Queryer& stage, Args&... args) {
+        auto* world     = stage.current_world();
+        const auto tick = world->advance_tick();
+        Command command{ world, tick, !node.access.exclusive };
+        Queryer queryer{ world, node.last_run, tick };
+        node.last_run = tick;
+
+        command_buffer::scope scope{ node.access.exclusive ? nullptr : &node.buffer };
+        node.func(command, queryer, args...);
+    }
+
+    void apply_buffers() {
+        for (auto& node : nodes_) {
+            node.buffer.apply();
+        }
+    }
+
+    void build() {
+        std::ranges::stable_sort(nodes_, [](const node& lhs, const node& rhs) {
+            return lhs.priority > rhs.priority;
+        });
+        for (auto& node : nodes_) {
+            node.successors.clear();
+            node.predecessors = 0;
+        }
+        for (std::uint32_t i = 0; i < nodes_.size(); ++i) {
+            for (auto j = i + 1; j < nodes_.size(); ++j) {
+                if (nodes_[i].access.conflicts(nodes_[j].access)) {
+                    nodes_[i].successors.emplace_back(j);
+                    ++nodes_[j].predecessors;
+                }
+            }
+        }
+        dirty_ = false;
+    }
+
+    vector<node> nodes_;
+    bool dirty_{};
+};
+
+} // namespace atom::ecs
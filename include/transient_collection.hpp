@@ -1,124 +1,266 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <span>
+#include <stdexcept>
+#include <thread>
 #include <utility>
-#include <unordered_map>
-#include <shared_mutex>
-#include <reflection.hpp>
-#include <memory/allocator.hpp>
-#include <structures/dense_map.hpp>
+#include "containers.hpp"
+#include "ecs.hpp"
 
 namespace atom::ecs {
 
-template <typename Alloc = std::allocator<std::pair<default_id_t, std::pair<void(*)(void*, const std::any&), std::vector<void*, std::allocator<void*>>>>>
-class transient_collection {
-    template <typename Ty>
-    using allocator_t = typename utils::rebind_allocator<Alloc>::template to_t<Ty>;
-
-    using deletor_type = void(*)(internal_pointer, const Alloc&);
-    using internal_pointer = void*;
-    using internal_allocator = allocator_t<internal_pointer>;
-
-    using alty = allocator_t<std::pair<deletor_type, std::vector<internal_pointer, internal_allocator>>>;
-    using alty_traits = std::allocator_traits<alty>;
+/**
+ * @brief Event channel without its event type, so that a collection could swap all of them.
+ *
+ */
+class basic_event_channel {
 public:
-    using value_type = std::pair<default_id_t, >
-    using allocator_type = alty;
+    basic_event_channel() noexcept;
 
-    template <typename Al>
-    transient_collection(std::allocator_arg_t, const Al& al) : events_(std::allocator_arg, al) {}
+    basic_event_channel(const basic_event_channel&)            = delete;
+    basic_event_channel(basic_event_channel&&)                 = delete;
+    basic_event_channel& operator=(const basic_event_channel&) = delete;
+    basic_event_channel& operator=(basic_event_channel&&)      = delete;
 
-    template <typename Al>
-    transient_collection(const Al& al) : events_(std::allocator_arg, al) {}
+    virtual ~basic_event_channel() noexcept = default;
 
-    transient_collection(const transient_collection&) = delete;
+    /**
+     * @brief Make the events sent so far readable, and drop the ones read in the last frame.
+     *
+     */
+    virtual void swap() noexcept = 0;
 
-    transient_collection(transient_collection&& that) noexcept : events_(std::move(that.events_)) {}
+protected:
+    // unique among all the channels ever made, so that a thread never mistakes a new channel at
+    // the address of a destroyed one for its cached one.
+    std::uint64_t id_;
+};
 
-    transient_collection& operator=(const transient_collection&) = delete;
+/**
+ * @brief Double buffered channel of one type of event.
+ *
+ * Each thread that sends appends to a segment of its own, found through a thread local cache, so
+ * sending takes no lock. Readers see the events sent before the last `swap`, which nobody writes
+ * to anymore, so systems that send and systems that read an event don't conflict. Events of a
+ * thread keep their order, the order between threads is unspecified.
+ *
+ * Events could be sent from systems and from the thread that updates the world, but not while
+ * the world swaps the channels.
+ *
+ * @tparam Event Event type.
+ */
+template <typename Event>
+class event_channel final : public basic_event_channel {
+    struct segment {
+        std::thread::id owner;
+        vector<Event> buffers[2];
+        segment* next;
+    };
 
-    transient_collection& operator=(transient_collection&& that) {
-        if (this != &that) {
-            // NOTE: if move directly, events in this transient collection would cause a memory leak.
-            // so, the suitable way to impl move this function is neither swap nor pop before moving.
-            // the further could move quickly, but the latter could release memory blocks earlier.
-            std::swap(events_, that.events_);
+public:
+    event_channel() noexcept = default;
+
+    ~event_channel() noexcept override {
+        for (auto* segment = head_.load(std::memory_order_acquire); segment;) {
+            delete std::exchange(segment, segment->next);
         }
-        return *this;
     }
 
-    ~transient_collection() {
-        pop();
+    /**
+     * @brief Append an event, it could be read after the next swap.
+     *
+     */
+    template <typename... Args>
+    void send(Args&&... args) {
+        local().buffers[current_].emplace_back(std::forward<Args>(args)...);
     }
 
-    template <typename EventType, typename Event, size_t hash = utils::hash_of<EventType>()>
-    void push(Event&& event) {
-        using event_allocator = allocator_t<EventType>;
+    void swap() noexcept override {
+        current_ ^= 1U;
+        for (auto* segment = head_.load(std::memory_order_acquire); segment;
+             segment       = segment->next) {
+            segment->buffers[current_].clear();
+        }
+    }
 
-        auto alloc = events_.get_allocator();
-        event_allocator allocator { alloc };
-        auto* const ptr = allocator.allocate(1);
-        std::allocator_traits<event_allocator>::construct(allocator, ptr, std::forward<Event>(event));
-        auto* e = std::launder(ptr);
+    /**
+     * @brief Call a function with each contiguous span of the readable events.
+     *
+     */
+    template <typename Func>
+    void each_span(Func&& func) const {
+        for (const auto* segment = head_.load(std::memory_order_acquire); segment;
+             segment             = segment->next) {
+            if (const auto& events = segment->buffers[current_ ^ 1U]; !events.empty()) {
+                func(std::span<const Event>{ events });
+            }
+        }
+    }
 
-        const auto ident = identity(hash);
-        std::unique_lock<std::shared_mutex> ulock(mutex_);
+    /**
+     * @brief Number of readable events.
+     *
+     */
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        std::size_t size{};
+        each_span([&size](const std::span<const Event> events) { size += events.size(); });
+        return size;
+    }
 
-        if (auto iter = events_.find(ident); iter != events_.end()) {
-            auto& [destroyer, vector] = iter->second;
-            vector.emplace_back(e);
+private:
+    auto local() -> segment& {
+        struct cache {
+            std::uint64_t channel;
+            segment* cached;
+        };
+        thread_local cache last{};
+
+        if (last.cached && last.channel == id_) [[likely]] {
+            return *last.cached;
         }
-        else {
-            std::pair<void(*)(void*, const allocator_type&), std::vector<internal_pointer, internal_allocator>> pair([](internal_pointer* ptr, const Alloc& alloc){
-                EventType* event = static_cast<EventType*>(ptr);
-                event_allocator allocator { alloc };
-                std::allocator_traits<event_allocator>::destroy(allocator, event);
-                allocator.deallocate(event, 1);
-            }, alloc);
-            pair.second.emplace_back(e);
-            events_.emplace(ident, std::move(pair));
+
+        // the thread has a segment already if it sent to this channel before, otherwise one is
+        // pushed to the front of the list.
+        const auto owner = std::this_thread::get_id();
+        auto* head       = head_.load(std::memory_order_acquire);
+        for (auto* segment = head; segment; segment = segment->next) {
+            if (segment->owner == owner) {
+                last = { id_, segment };
+                return *segment;
+            }
         }
+        auto* created = new segment{ owner, {}, head };
+        while (!head_.compare_exchange_weak(
+            created->next, created, std::memory_order_release, std::memory_order_acquire
+        )) {}
+        last = { id_, created };
+        return *created;
     }
 
-    void pop() {
-        auto alloc = events_.get_allocator();
-        Alloc _alloc { alloc };
-        std::unique_lock<std::shared_mutex> ulock(mutex_);
-        for (auto& [ident, pair] : events_) {
-            auto& [deletor, vector] = pair;
-            for (auto ptr : vector) {
-                deletor(ptr, _alloc);
+    std::atomic<segment*> head_;
+    unsigned current_{};
+};
+
+/**
+ * @brief Readable events of a type, in contiguous spans.
+ *
+ * @tparam Event Event type.
+ */
+template <typename Event>
+class event_reader {
+public:
+    explicit event_reader(const event_channel<Event>* channel) noexcept : channel_(channel) {}
+
+    /**
+     * @brief Call a function with each event.
+     *
+     */
+    template <typename Func>
+    void each(Func&& func) const {
+        each_span([&func](const std::span<const Event> events) {
+            for (const auto& event : events) {
+                func(event);
             }
-            vector.clear();
-        }
+        });
     }
 
-    template <typename EventType, size_t hash = utils::hash_of<EventType>()>
-    decltype(auto) _() noexcept {
-        // TODO: a function name
-        // WARNING: events got at this time, but maybe after calling this function, events were changed.
-        const auto ident = identity(hash);
-        std::shared_lock<std::shared_mutex> slock(mutex_);
-        if (auto iter = events_.find(ident); iter != events_.end()) {
-            auto& pair = iter->second;
-            return pair->second;
+    /**
+     * @brief Call a function with each contiguous span of events.
+     *
+     */
+    template <typename Func>
+    void each_span(Func&& func) const {
+        if (channel_) {
+            channel_->each_span(std::forward<Func>(func));
         }
     }
 
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return channel_ ? channel_->size() : 0;
+    }
+
+    [[nodiscard]] auto empty() const noexcept -> bool { return !size(); }
+
 private:
-    static default_id_t identity(const size_t hash) {
-        static std::unordered_map<size_t, default_id_t> map;
-        if (auto iter = map.find(hash); iter != map.end()) [[likely]] {
-            return iter->second;
+    const event_channel<Event>* channel_;
+};
+
+/**
+ * @brief Event channels of a world, indexed by `event_index`.
+ *
+ * Channels are made at the first send, from any thread.
+ */
+class transient_collection {
+public:
+    /**
+     * @brief Max number of event types.
+     *
+     */
+    constexpr static std::size_t max_events = 256;
+
+    transient_collection();
+
+    transient_collection(const transient_collection&)            = delete;
+    transient_collection(transient_collection&&)                 = delete;
+    transient_collection& operator=(const transient_collection&) = delete;
+    transient_collection& operator=(transient_collection&&)      = delete;
+
+    ~transient_collection() noexcept;
+
+    /**
+     * @brief Channel of a type of event, made if there is none.
+     *
+     */
+    template <typename Event>
+    [[nodiscard]] auto channel() -> event_channel<Event>& {
+        auto& slot = slot_of(event_index<Event>());
+        if (auto* channel = slot.load(std::memory_order_acquire)) [[likely]] {
+            return *static_cast<event_channel<Event>*>(channel);
         }
-        else {
-            auto ident = map.size();
-            map_.emplace(hash, ident);
-            return ident;
+
+        // threads that race to make it keep the first one.
+        auto created             = std::make_unique<event_channel<Event>>();
+        basic_event_channel* old = nullptr;
+        if (slot.compare_exchange_strong(
+                old, created.get(), std::memory_order_acq_rel, std::memory_order_acquire
+            )) {
+            return *created.release();
+        }
+        return *static_cast<event_channel<Event>*>(old);
+    }
+
+    /**
+     * @brief Channel of a type of event.
+     *
+     * @return `nullptr` if nothing was sent yet.
+     */
+    template <typename Event>
+    [[nodiscard]] auto find() const -> const event_channel<Event>* {
+        const auto identity = event_index<Event>();
+        return identity < max_events ? static_cast<const event_channel<Event>*>(
+                                           channels_[identity].load(std::memory_order_acquire)
+                                       )
+                                     : nullptr;
+    }
+
+    /**
+     * @brief Swap all the channels, once a frame.
+     *
+     */
+    void swap() noexcept;
+
+private:
+    auto slot_of(const event::id_t identity) -> std::atomic<basic_event_channel*>& {
+        if (identity >= max_events) [[unlikely]] {
+            throw std::runtime_error("Too many event types!");
         }
+        return channels_[identity];
     }
 
-    std::shared_mutex mutex_;
-    utils::dense_map<default_id_t, std::pair<void(*)(void*), std::vector<internal_pointer, internal_allocator>>, alty> events_;
+    std::unique_ptr<std::atomic<basic_event_channel*>[]> channels_;
 };
 
-}
+} // namespace atom::ecs
@@ -0,0 +1,540 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "archetype.hpp"
+#include "containers.hpp"
+#include "ecs.hpp"
+#include "entity_set.hpp"
+#include "parallel.hpp"
+#include "query.hpp"
+#include "sparse_set.hpp"
+
+namespace atom::ecs {
+
+namespace internal {
+
+/**
+ * @brief Storage of a type of component, resolved once when a view is made.
+ *
+ */
+template <typename Component, bool = is_table_component_v<std::remove_const_t<Component>>>
+struct view_storage {
+    using value_type = std::remove_const_t<Component>;
+
+    sparse_set<value_type>* storage;
+    component::id_t identity;
+
+    [[nodiscard]] auto contains(const entity::index_t index) const noexcept -> bool {
+        return storage && storage->contains(index);
+    }
+
+    [[nodiscard]] auto get(const entity::index_t index) const noexcept -> Component& {
+        return storage->get(index);
+    }
+
+    [[nodiscard]] auto ticks(const entity::index_t index) const noexcept -> component_ticks* {
+        return storage ? storage->ticks_of(index) : nullptr;
+    }
+};
+
+template <typename Component>
+struct view_storage<Component, true> {
+    using value_type = std::remove_const_t<Component>;
+
+    const archetype_storage* tables;
+    component::id_t identity;
+
+    [[nodiscard]] auto contains(const entity::index_t index) const noexcept -> bool {
+        return tables->contains(index, identity);
+    }
+
+    [[nodiscard]] auto get(const entity::index_t index) const noexcept -> Component& {
+        return *tables->find<value_type>(index, identity);
+    }
+
+    [[nodiscard]] auto ticks(const entity::index_t index) const noexcept -> component_ticks* {
+        return tables->ticks_of(index, identity);
+    }
+};
+
+} // namespace internal
+
+/**
+ * @brief Iterate entities with all of the components, handing out the components directly.
+ *
+ * Storages are resolved once when the view is made. `each` is the fastest way to iterate, the
+ * view itself is also a range of `std::tuple<entity::id_t, Components&...>`, which could be used
+ * with structured bindings.
+ *
+ * Attaching or detaching components of the iterated types while iterating is not allowed.
+ * `par_each` splits the iteration into chunks that run on the work stealing executor.
+ *
+ * Components that are not `const` are stamped as changed when they are handed out. `added` and
+ * `changed` narrow the view to the entities whose components were attached or changed since the
+ * previous run of the system.
+ *
+ * @tparam Components Component types, `const` ones are handed out as constant references.
+ */
+template <typename... Components>
+class component_view {
+    constexpr static std::size_t count = sizeof...(Components);
+
+    template <std::size_t Index>
+    using component_t = std::tuple_element_t<Index, std::tuple<Components...>>;
+
+    template <std::size_t Index>
+    constexpr static bool is_table_v =
+        is_table_component_v<std::remove_const_t<component_t<Index>>>;
+
+    template <std::size_t Index>
+    constexpr static bool is_mutable_v = !std::is_const_v<component_t<Index>>;
+
+    static_assert(count <= 64, "too many components in a view");
+
+public:
+    using value_type = std::tuple<entity::id_t, Components&...>;
+
+    class iterator {
+    public:
+        using value_type        = component_view::value_type;
+        using reference         = value_type;
+        using difference_type   = std::ptrdiff_t;
+        using iterator_concept  = std::forward_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+
+        iterator() noexcept = default;
+        iterator(const component_view* view, const std::size_t segment) noexcept
+            : view_(view), segment_(segment) {
+            satisfy();
+        }
+
+        [[nodiscard]] auto operator*() const noexcept -> value_type {
+            const auto entity = (*view_->segments_[segment_].first)[offset_];
+            return view_->fetch(entity, std::index_sequence_for<Components...>{});
+        }
+
+        auto operator++() noexcept -> iterator& {
+            ++offset_;
+            satisfy();
+            return *this;
+        }
+
+        auto operator++(int) noexcept -> iterator {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        [[nodiscard]] friend auto operator==(const iterator& lhs, const iterator& rhs) noexcept
+            -> bool {
+            return lhs.segment_ == rhs.segment_ && lhs.offset_ == rhs.offset_;
+        }
+
+        [[nodiscard]] friend auto operator==(const iterator& iter, std::default_sentinel_t) noexcept
+            -> bool {
+            return iter.done();
+        }
+
+    private:
+        [[nodiscard]] auto done() const noexcept -> bool {
+            return segment_ == view_->segments_.size();
+        }
+
+        void satisfy() noexcept {
+            const auto& segments = view_->segments_;
+            for (; segment_ < segments.size(); ++segment_, offset_ = 0) {
+                const auto& entities = *segments[segment_].first;
+                for (; offset_ < entities.size(); ++offset_) {
+                    if (view_->accept(entities[offset_])) {
+                        return;
+                    }
+                }
+            }
+        }
+
+        const component_view* view_{};
+        std::size_t segment_{};
+        std::size_t offset_{};
+    };
+
+    component_view(
+        const entity_set* living,
+        const archetype_storage* tables,
+        std::tuple<internal::view_storage<Components>...> storages,
+        const component::tick_t since,
+        const component::tick_t tick
+    )
+        : living_(living), tables_(tables), storages_(storages), since_(since), tick_(tick),
+          driver_(plan()) {
+        if (driver_ == count) {
+            // tagged with the position of the table
+            const auto& tables = tables_->archetypes();
+            for (std::size_t i = 0; i < tables.size(); ++i) {
+                if (tables[i]->size() && matches(*tables[i])) {
+                    segments_.emplace_back(&tables[i]->entities(), i);
+                }
+            }
+        }
+        else if (driver_ != npos) {
+            segments_.emplace_back(&sparse_entities(driver_), driver_);
+        }
+    }
+
+    /**
+     * @brief Only the entities whose components of these types were attached since the
+     * previous run of the system.
+     *
+     * @tparam Filters Component types of the view.
+     */
+    template <typename... Filters>
+    [[nodiscard]] auto added() const -> component_view {
+        auto copy = *this;
+        copy.added_ |= mask_of<Filters...>();
+        return copy;
+    }
+
+    /**
+     * @brief Only the entities whose components of these types were attached or changed since
+     * the previous run of the system.
+     *
+     * A component is changed when it is handed out mutably, by a view, `queryer::get` or
+     * `command::modify`, whether or not it is written.
+     *
+     * @tparam Filters Component types of the view.
+     */
+    template <typename... Filters>
+    [[nodiscard]] auto changed() const -> component_view {
+        auto copy = *this;
+        copy.changed_ |= mask_of<Filters...>();
+        return copy;
+    }
+
+    [[nodiscard]] auto begin() const noexcept -> iterator { return iterator{ this, 0 }; }
+    [[nodiscard]] auto end() const noexcept -> std::default_sentinel_t { return {}; }
+
+    /**
+     * @brief Call a function for each matching entity.
+     *
+     * @param func Invocable with `(entity::id_t, Components&...)` or `(Components&...)`.
+     */
+    template <typename Func>
+    void each(Func&& func) const {
+        for (std::size_t i = 0; i < segments_.size(); ++i) {
+            each_segment(func, i, 0, segments_[i].first->size());
+        }
+    }
+
+    /**
+     * @brief Call a function for each matching entity, in chunks of `grain` in parallel.
+     *
+     * @param func Invocable with `(entity::id_t, Components&...)` or `(Components&...)`.
+     * @param grain Number of entities in a chunk.
+     */
+    template <typename Func>
+    void par_each(Func&& func, const std::size_t grain = internal::default_grain) const {
+        struct chunk {
+            std::size_t segment;
+            std::size_t first;
+            std::size_t last;
+        };
+
+        const auto step = grain ? grain : 1;
+        vector<chunk> chunks;
+        for (std::size_t i = 0; i < segments_.size(); ++i) {
+            const auto size = segments_[i].first->size();
+            for (std::size_t first = 0; first < size; first += step) {
+                chunks.push_back({ i, first, std::min(first + step, size) });
+            }
+        }
+
+        internal::parallel_for(chunks.size(), [this, &func, &chunks](const std::size_t i) {
+            const auto& [segment, first, last] = chunks[i];
+            each_segment(func, segment, first, last);
+        });
+    }
+
+private:
+    constexpr static std::size_t npos = (std::numeric_limits<std::size_t>::max)();
+
+    /**
+     * @brief Choose what to iterate: the smallest sparse set, or the tables holding all the table
+     * components (`count`). `npos` means nothing could match.
+     */
+    [[nodiscard]] auto plan() const noexcept -> std::size_t {
+        return plan_impl(std::index_sequence_for<Components...>{});
+    }
+
+    template <std::size_t... Is>
+    [[nodiscard]] auto plan_impl(std::index_sequence<Is...>) const noexcept -> std::size_t {
+        std::size_t driver = npos;
+        std::size_t least  = (std::numeric_limits<std::size_t>::max)();
+        bool missing       = false;
+        const auto consider = [&]<std::size_t I>() {
+            if constexpr (!is_table_v<I>) {
+                const auto* storage = std::get<I>(storages_).storage;
+                if (!storage) {
+                    missing = true;
+                }
+                else if (storage->size() < least) {
+                    least  = storage->size();
+                    driver = I;
+                }
+            }
+        };
+        (consider.template operator()<Is>(), ...);
+        if (missing) {
+            return npos;
+        }
+
+        if constexpr ((is_table_v<Is> || ...)) {
+            std::size_t candidates{};
+            for (const auto& table : tables_->archetypes()) {
+                if (matches(*table)) {
+                    candidates += table->size();
+                }
+            }
+            if (candidates < least) {
+                driver = count;
+            }
+        }
+        return driver;
+    }
+
+    [[nodiscard]] auto matches(const archetype& table) const noexcept -> bool {
+        return matches_impl(table, std::index_sequence_for<Components...>{});
+    }
+
+    template <std::size_t... Is>
+    [[nodiscard]] auto matches_impl(const archetype& table, std::index_sequence<Is...>)
+        const noexcept -> bool {
+        return ((!is_table_v<Is> || table.contains(std::get<Is>(storages_).identity)) && ...);
+    }
+
+    [[nodiscard]] auto sparse_entities(const std::size_t index) const noexcept
+        -> const vector<entity::id_t>& {
+        return sparse_entities_impl(index, std::index_sequence_for<Components...>{});
+    }
+
+    template <std::size_t... Is>
+    [[nodiscard]] auto sparse_entities_impl(const std::size_t index, std::index_sequence<Is...>)
+        const noexcept -> const vector<entity::id_t>& {
+        const vector<entity::id_t>* entities{};
+        const auto pick = [&]<std::size_t I>() {
+            if constexpr (!is_table_v<I>) {
+                if (I == index) {
+                    entities = &std::get<I>(storages_).storage->entities();
+                }
+            }
+        };
+        (pick.template operator()<Is>(), ...);
+        return *entities;
+    }
+
+    template <typename Filter>
+    [[nodiscard]] constexpr static auto position_of() noexcept -> std::size_t {
+        constexpr bool same[] = { std::is_same_v<std::remove_const_t<Components>, Filter>... };
+        return static_cast<std::size_t>(std::ranges::find(same, true) - std::ranges::begin(same));
+    }
+
+    template <typename... Filters>
+    [[nodiscard]] constexpr static auto mask_of() noexcept -> std::uint64_t {
+        static_assert(
+            ((position_of<std::remove_const_t<Filters>>() != count) && ...),
+            "a filter must be a component of the view"
+        );
+        return ((std::uint64_t{ 1 } << position_of<std::remove_const_t<Filters>>()) | ... | 0);
+    }
+
+    [[nodiscard]] auto accept(const entity::id_t entity) const noexcept -> bool {
+        const entity::index_t index = entity >> magic_32;
+        return living_->contains(entity) &&
+               accept_impl(index, std::index_sequence_for<Components...>{}) &&
+               (!(added_ | changed_) || fresh(index, std::index_sequence_for<Components...>{}));
+    }
+
+    template <std::size_t... Is>
+    [[nodiscard]] auto accept_impl(const entity::index_t index, std::index_sequence<Is...>)
+        const noexcept -> bool {
+        return ((Is == driver_ || (driver_ == count && is_table_v<Is>) ||
+                 std::get<Is>(storages_).contains(index)) &&
+                ...);
+    }
+
+    /**
+     * @brief Whether the components of an entity pass the `added` and `changed` filters.
+     *
+     */
+    template <std::size_t... Is>
+    [[nodiscard]] auto fresh(const entity::index_t index, std::index_sequence<Is...>)
+        const noexcept -> bool {
+        const auto passes = [&]<std::size_t I>() {
+            const auto bit = std::uint64_t{ 1 } << I;
+            if (!((added_ | changed_) & bit)) {
+                return true;
+            }
+            const auto* ticks = std::get<I>(storages_).ticks(index);
+            const auto stamp  = (added_ & bit) ? ticks->added : ticks->changed;
+            return is_newer(stamp, since_) && !is_newer(stamp, tick_);
+        };
+        return (passes.template operator()<Is>() && ...);
+    }
+
+    template <std::size_t... Is>
+    [[nodiscard]] auto fetch(const entity::id_t entity, std::index_sequence<Is...>) const noexcept
+        -> value_type {
+        const entity::index_t index = entity >> magic_32;
+        (stamp<Is>(std::get<Is>(storages_).ticks(index)), ...);
+        return value_type{ entity, std::get<Is>(storages_).get(index)... };
+    }
+
+    template <std::size_t I>
+    void stamp(component_ticks* ticks) const noexcept {
+        if constexpr (is_mutable_v<I>) {
+            ticks->changed = tick_;
+        }
+    }
+
+    template <typename Func, typename... Args>
+    static void invoke(Func& func, const entity::id_t entity, Args&... args) {
+        if constexpr (std::is_invocable_v<Func&, entity::id_t, Args&...>) {
+            func(entity, args...);
+        }
+        else {
+            func(args...);
+        }
+    }
+
+    /**
+     * @brief Call a function for the matching entities in `[first, last)` of a segment.
+     *
+     */
+    template <typename Func>
+    void each_segment(
+        Func& func, const std::size_t segment, const std::size_t first, const std::size_t last
+    ) const {
+        each_segment_impl(func, segment, first, last, std::index_sequence_for<Components...>{});
+    }
+
+    template <typename Func, std::size_t... Is>
+    void each_segment_impl(
+        Func& func,
+        const std::size_t segment,
+        const std::size_t first,
+        const std::size_t last,
+        std::index_sequence<Is...>
+    ) const {
+        if (driver_ == count) {
+            const auto& table = *tables_->archetypes()[segments_[segment].second];
+            each_table(func, table, first, last, std::index_sequence<Is...>{});
+        }
+        else {
+            // one loop for each possible driver, so that the driver is read by position.
+            ((driver_ == Is ? each_sparse<Is>(func, first, last, std::index_sequence<Is...>{})
+                            : void()),
+             ...);
+        }
+    }
+
+    template <std::size_t Driver, typename Func, std::size_t... Is>
+    void each_sparse(
+        Func& func, const std::size_t first, const std::size_t last, std::index_sequence<Is...>
+    ) const {
+        if constexpr (!is_table_v<Driver>) {
+            auto* storage         = std::get<Driver>(storages_).storage;
+            const auto& entities  = storage->entities();
+            auto& components      = storage->components();
+            auto& ticks           = storage->ticks();
+            const auto get = [&]<std::size_t I>(const std::size_t pos, const entity::index_t index)
+                -> component_t<I>& {
+                if constexpr (I == Driver) {
+                    stamp<I>(&ticks[pos]);
+                    return components[pos];
+                }
+                else {
+                    stamp<I>(std::get<I>(storages_).ticks(index));
+                    return std::get<I>(storages_).get(index);
+                }
+            };
+
+            for (std::size_t pos = first; pos < last; ++pos) {
+                const auto entity = entities[pos];
+                if (accept(entity)) {
+                    const entity::index_t index = entity >> magic_32;
+                    invoke(func, entity, get.template operator()<Is>(pos, index)...);
+                }
+            }
+        }
+    }
+
+    template <typename Func, std::size_t... Is>
+    void each_table(
+        Func& func,
+        const archetype& table,
+        const std::size_t first,
+        const std::size_t last,
+        std::index_sequence<Is...>
+    ) const {
+        // columns of the table components, the others are looked up.
+        const std::tuple columns{ column_data<Is>(table)... };
+        const std::tuple ticks{ column_ticks<Is>(table)... };
+        const auto get = [&]<std::size_t I>(const std::size_t row, const entity::index_t index)
+            -> component_t<I>& {
+            if constexpr (is_table_v<I>) {
+                stamp<I>(std::get<I>(ticks) + row);
+                return std::get<I>(columns)[row];
+            }
+            else {
+                stamp<I>(std::get<I>(storages_).ticks(index));
+                return std::get<I>(storages_).get(index);
+            }
+        };
+
+        const auto& entities = table.entities();
+        for (std::size_t row = first; row < last; ++row) {
+            const auto entity = entities[row];
+            if (accept(entity)) {
+                const entity::index_t index = entity >> magic_32;
+                invoke(func, entity, get.template operator()<Is>(row, index)...);
+            }
+        }
+    }
+
+    template <std::size_t I>
+    [[nodiscard]] auto column_data(const archetype& table) const noexcept {
+        using value_t = std::remove_const_t<component_t<I>>;
+        if constexpr (is_table_v<I>) {
+            return table.find(std::get<I>(storages_).identity)->template data<value_t>();
+        }
+        else {
+            return static_cast<value_t*>(nullptr);
+        }
+    }
+
+    template <std::size_t I>
+    [[nodiscard]] auto column_ticks(const archetype& table) const noexcept -> component_ticks* {
+        if constexpr (is_table_v<I>) {
+            return table.find(std::get<I>(storages_).identity)->ticks();
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    const entity_set* living_;
+    const archetype_storage* tables_;
+    std::tuple<internal::view_storage<Components>...> storages_;
+    component::tick_t since_;
+    component::tick_t tick_;
+    std::uint64_t added_{};
+    std::uint64_t changed_{};
+    std::size_t driver_;
+    internal::segment_list segments_;
+};
+
+} // namespace atom::ecs
@@ -1,12 +1,28 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <tuple>
 #include <utility>
+#include "archetype.hpp"
 #include "containers.hpp"
 #include "ecs.hpp"
+#include "entity_set.hpp"
+#include "frame_arena.hpp"
 #include "memory.hpp"
 #include "memory/allocator.hpp"
 #include "memory/pool.hpp"
-#include "memory/storage.hpp"
+#include "query.hpp"
 #include "reflection.hpp"
+#include "resource_table.hpp"
+#include "resources.hpp"
+#include "signature.hpp"
+#include "sparse_set.hpp"
+#include "system_graph.hpp"
+#include "transient_collection.hpp"
 
 namespace atom::ecs {
 
@@ -20,6 +36,9 @@ class world final {
     friend class command;
     friend class queryer;
 
+    template <typename, typename, typename...>
+    friend class system_graph;
+
 public:
     using pool_t = ::atom::utils::synchronized_pool;
 
@@ -43,86 +62,285 @@ public:
 
     /**
      * @brief Systems with higher priority will be startuped eralier.
+     *
+     * A system that declares `reads` and/or `writes` type lists only waits for the systems it
+     * conflicts with, see `system_access::of`. Otherwise it runs alone. Removals of the components
+     * it reads are tracked from now on, see `queryer::removed`.
      */
     template <typename Sys>
-    requires requires { Sys::startup(std::declval<command>(), std::declval<queryer>()); } ||
+    requires requires { Sys::startup(std::declval<command&>(), std::declval<queryer&>()); } ||
              requires {
                  Sys::update(
-                     std::declval<command>(), std::declval<queryer>(), std::declval<float>()
+                     std::declval<command&>(), std::declval<queryer&>(), std::declval<float>()
                  );
-             } || requires { Sys::shutdown(std::declval<command>(), std::declval<queryer>()); }
+             } || requires { Sys::shutdown(std::declval<command&>(), std::declval<queryer&>()); }
     void add_system() {
+        const auto access = system_access::of<Sys>();
+        access.reads.for_each([this](const component::id_t id) { track_removals(id); });
+
         if constexpr (requires {
-                          Sys::startup(std::declval<ecs::command>(), std::declval<queryer>());
+                          Sys::startup(std::declval<ecs::command&>(), std::declval<queryer&>());
                       }) {
             if constexpr (requires { Sys::startup_priority_v; }) {
-                add_startup(&Sys::startup, Sys::startup_priority_v);
+                add_startup(&Sys::startup, Sys::startup_priority_v, access);
             }
             else {
-                add_startup(&Sys::startup);
+                add_startup(&Sys::startup, normal_priority, access);
             }
         }
 
         if constexpr (requires {
                           Sys::update(
-                              std::declval<ecs::command>(),
-                              std::declval<queryer>(),
+                              std::declval<ecs::command&>(),
+                              std::declval<queryer&>(),
                               std::declval<float>()
                           );
                       }) {
             if constexpr (requires { Sys::update_priority_v; }) {
-                add_update(&Sys::update, Sys::update_priority_v);
+                add_update(&Sys::update, Sys::update_priority_v, access);
             }
             else {
-                add_update(&Sys::update);
+                add_update(&Sys::update, normal_priority, access);
             }
         }
 
         if constexpr (requires {
-                          Sys::shutdown(std::declval<ecs::command>(), std::declval<queryer>());
+                          Sys::shutdown(std::declval<ecs::command&>(), std::declval<queryer&>());
                       }) {
             if constexpr (requires { Sys::shutdown_priority_v; }) {
-                add_shutdown(&Sys::shutdown, Sys::shutdown_priority_v);
+                add_shutdown(&Sys::shutdown, Sys::shutdown_priority_v, access);
             }
             else {
-                add_shutdown(&Sys::shutdown);
+                add_shutdown(&Sys::shutdown, normal_priority, access);
             }
         }
     }
 
-    void add_startup(void (*func)(command&, queryer&), const priority = normal_priority);
-    void add_update(void (*func)(command&, queryer&, float), const priority = normal_priority);
-    void add_shutdown(void (*func)(command&, queryer&), const priority = normal_priority);
+    void add_startup(
+        void (*func)(command&, queryer&),
+        const priority = normal_priority,
+        system_access access = {}
+    );
+    void add_update(
+        void (*func)(command&, queryer&, float),
+        const priority = normal_priority,
+        system_access access = {}
+    );
+    void add_shutdown(
+        void (*func)(command&, queryer&),
+        const priority = normal_priority,
+        system_access access = {}
+    );
+
+    /**
+     * @brief Start logging removals of these components, see `queryer::removed`.
+     *
+     */
+    template <typename... Components>
+    void track_removals() noexcept {
+        (track_removals(component_index<Components>()), ...);
+    }
 
     void startup();
     void update(float delta_time);
     void shutdown();
 
+    /**
+     * @brief Register a query whose matching entities are maintained incrementally.
+     *
+     * Calling it again with the same filters returns the same query. Queries should be made while
+     * no system is running in parallel, e.g. in a startup system on the main thread.
+     *
+     * @tparam Filters `all<...>`, `any<...>` and `none<...>`.
+     */
+    template <typename... Filters>
+    auto make_query() -> cached_query& {
+        constexpr auto hash = utils::hash_of<std::tuple<Filters...>>();
+        if (auto iter = cached_queries_.find(hash); iter != cached_queries_.end()) [[likely]] {
+            return *iter->second;
+        }
+
+        vector<component::id_t> all;
+        vector<component::id_t> any;
+        vector<component::id_t> none;
+        (internal::query_filter<Filters>::collect(all, any, none), ...);
+
+        auto* query =
+            cached_queries_
+                .emplace(hash, std::make_unique<cached_query>(all, any, none))
+                .first->second.get();
+        for (const auto& ids : { all, any, none }) {
+            for (const auto id : ids) {
+                if (id >= query_index_.size()) {
+                    query_index_.resize(static_cast<std::size_t>(id) + 1);
+                }
+                query_index_[id].emplace_back(query);
+            }
+        }
+        if (query->unbounded()) {
+            unbounded_queries_.emplace_back(query);
+        }
+
+        // seed it with a scan of the signatures, only `any` is left to check.
+        signature include;
+        signature exclude;
+        for (const auto id : all) {
+            include.set(id);
+        }
+        for (const auto id : none) {
+            exclude.set(id);
+        }
+        vector<entity::index_t> indices;
+        entities_.select(include, exclude, indices);
+
+        auto has = [this](const component::id_t id, const entity::index_t index) {
+            return contains(id, index);
+        };
+        for (const auto index : indices) {
+            query->refresh(entities_.id_of(index), has);
+        }
+        return *query;
+    }
+
+    /**
+     * @brief Write a binary snapshot of the entities, their components and the resources.
+     *
+     * Types are known by `utils::hash_of`, so a snapshot is read back by the same build. Trivially
+     * copyable types are written as raw blocks that start at multiples of 64 bytes from the start
+     * of the snapshot, others need a `snapshot_serializer` and are left out without one. Change
+     * ticks, events and logged removals are not saved. Not while systems run.
+     *
+     * @throw std::runtime_error If the stream fails.
+     */
+    void save(std::ostream& out) const;
+
+    /**
+     * @brief Replace the entities and their components by the ones of a snapshot.
+     *
+     * Resources in the snapshot replace the ones of this world once all of it has been read, the
+     * others are kept. Loaded components count as added by a new tick. Types this process doesn't
+     * know are skipped. Not while systems run.
+     *
+     * @throw std::runtime_error If the snapshot is broken, then the world is left without entities
+     * and its resources are untouched.
+     */
+    void load(std::istream& in);
+
     [[nodiscard]] auto query() noexcept -> ecs::queryer;
     [[nodiscard]] auto command() noexcept -> ecs::command;
 
+    /**
+     * @brief The latest tick handed out.
+     *
+     * Each system run and each command made outside of systems gets a new tick, changes of
+     * components are stamped with it.
+     */
+    [[nodiscard]] auto change_tick() const noexcept -> component::tick_t {
+        return change_tick_.load(std::memory_order_relaxed);
+    }
+
 private:
+    /**
+     * @brief Sparse set of a type of component.
+     *
+     * @return `nullptr` if this type of component has never been attached.
+     */
+    template <typename Component>
+    [[nodiscard]] auto storage_of() const noexcept -> sparse_set<Component>* {
+        const auto index = component_index<Component>();
+        return index < component_storage_.size()
+                   ? static_cast<sparse_set<Component>*>(std::get<0>(component_storage_[index]))
+                   : nullptr;
+    }
+
+    [[nodiscard]] auto contains(const component::id_t id, const entity::index_t index) const
+        -> bool {
+        return entities_.signature_of(index).test(id);
+    }
+
+    auto advance_tick() noexcept -> component::tick_t {
+        return change_tick_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    /**
+     * @brief Start logging removals of a type of component. Thread safe.
+     *
+     * Removals are only logged from the single threaded paths: commands outside of systems,
+     * exclusive systems and the sync points that apply the deferred ones.
+     */
+    void track_removals(const component::id_t id) noexcept {
+        auto& word = removal_tracking_[id / signature::word_bits];
+        word.fetch_or(signature::word_type{ 1 } << (id % signature::word_bits));
+    }
+
+    void log_removal(
+        const entity::id_t entity, const component::id_t id, const component::tick_t tick
+    ) {
+        const auto word = removal_tracking_[id / signature::word_bits].load();
+        if ((word >> (id % signature::word_bits)) & 1U) [[unlikely]] {
+            removed_[id].push_back({ entity, tick });
+        }
+    }
+
+    /**
+     * @brief Log the removal of the components of an entity that are tracked.
+     *
+     */
+    void log_removals(
+        const entity::id_t entity, const signature& components, const component::tick_t tick
+    ) {
+        for (std::size_t i = 0; i < signature::word_count; ++i) {
+            auto word = components.words()[i] & removal_tracking_[i].load();
+            for (; word; word &= word - 1) {
+                const auto id = i * signature::word_bits + std::countr_zero(word);
+                removed_[id].push_back({ entity, tick });
+            }
+        }
+    }
+
+    // drop the removals logged before the previous update.
+    void prune_removals();
+
+    // keep every stored tick within `max_tick_age`, so `is_newer` holds after the ticks wrap.
+    void clamp_ticks();
+
+    [[nodiscard]] auto frame_arena() noexcept -> ecs::frame_arena* { return &frames_[frame_]; }
+
     bool shutdown_;
-    vector<entity::index_t> free_indices_;
-    vector<entity::generation_t> generations_;
-    unordered_set<entity::id_t> living_entities_;
-    vector<entity::id_t> pending_destroy_;
-    vector<std::tuple<void (*)(void*, utils::basic_allocator*), void*, utils::basic_allocator*>>
-        pending_components_;
-
-    dense_map<
-        component::id_t,
-        std::tuple<
-            dense_map<entity::index_t, void*>,
-            utils::basic_allocator*,
-            utils::basic_reflected*>>
-        component_storage_;
-
-    dense_map<resource::id_t, utils::basic_storage*> resource_storage_;
-
-    multimap<int, void (*)(ecs::command&, ecs::queryer&)> startup_systems_;
-    multimap<int, void (*)(ecs::command&, ecs::queryer&, float)> update_systems_;
-    multimap<int, void (*)(ecs::command&, ecs::queryer&)> shutdown_systems_;
+    std::atomic<component::tick_t> change_tick_;
+    entity_set entities_;
+    vector<entity::index_t> pending_destroy_;
+
+    // indexed by `component_index`
+    vector<std::tuple<basic_sparse_set*, utils::basic_reflected*>> component_storage_;
+    // killed entities of each sparse set, reused by every garbage collection
+    vector<vector<entity::index_t>> sweep_lists_;
+
+    archetype_storage archetypes_;
+
+    unordered_map<std::size_t, std::unique_ptr<cached_query>> cached_queries_;
+    vector<vector<cached_query*>> query_index_;
+    vector<cached_query*> unbounded_queries_;
+
+    resource_table resources_;
+    res_mut<resources::garbage_collect::enable_garbage_collect> garbage_collect_;
+
+    // event channels, swapped at the start of each update
+    transient_collection events_;
+
+    // scratch memory of the current and the previous update, see `command::frame_resource`
+    ecs::frame_arena frames_[2];
+    unsigned frame_{};
+
+    // removed components and the ticks of the removals, indexed by `component_index`
+    vector<vector<std::pair<entity::id_t, component::tick_t>>> removed_;
+    std::array<std::atomic<signature::word_type>, signature::word_count> removal_tracking_{};
+    component::tick_t last_update_tick_{};
+    component::tick_t last_clamp_tick_{};
+
+    system_graph<ecs::command, ecs::queryer> startup_systems_;
+    system_graph<ecs::command, ecs::queryer, float> update_systems_;
+    system_graph<ecs::command, ecs::queryer> shutdown_systems_;
 };
 
 } // namespace atom::ecs
@@ -0,0 +1,35 @@
+#include "asset_load.hpp"
+#include <coroutine>
+#include <mutex>
+#include <thread/thread_pool.hpp>
+#include "containers.hpp"
+#include "schedule.hpp"
+
+using namespace atom;
+
+auto ecs::internal::load_status::suspend(const std::coroutine_handle<> awaiting) -> bool {
+    std::lock_guard guard{ mutex_ };
+    if (state_.load(std::memory_order_relaxed) != load_state::loading) {
+        return false;
+    }
+    awaiting_.emplace_back(awaiting);
+    return true;
+}
+
+void ecs::internal::load_status::finish(const load_state state) {
+    vector<std::coroutine_handle<>> awaiting;
+    {
+        std::lock_guard guard{ mutex_ };
+        state_.store(state, std::memory_order_release);
+        awaiting.swap(awaiting_);
+    }
+    state_.notify_all();
+
+    for (auto handle : awaiting) {
+        scheduler::thread_pool().enqueue([handle] { handle.resume(); });
+    }
+}
+
+void ecs::internal::resume_on_pool::await_suspend(const std::coroutine_handle<> handle) const {
+    scheduler::thread_pool().enqueue([handle] { handle.resume(); });
+}
@@ -0,0 +1,285 @@
+#include "asset_pack.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include "containers.hpp"
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace atom;
+
+namespace {
+
+[[nodiscard]] auto align_up(const std::uint64_t offset, const std::uint64_t alignment) noexcept
+    -> std::uint64_t {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+ecs::asset_pack::~asset_pack() noexcept {
+#if defined(_WIN32)
+    if (data_) {
+        ::UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+        ::CloseHandle(mapping_);
+    }
+    if (file_ && file_ != INVALID_HANDLE_VALUE) {
+        ::CloseHandle(file_);
+    }
+#else
+    if (data_) {
+        ::munmap(const_cast<std::byte*>(data_), size_);
+    }
+#endif
+}
+
+auto ecs::asset_pack::open(const std::filesystem::path& path) -> std::shared_ptr<asset_pack> {
+    // the constructor is private, so no `make_shared`.
+    std::shared_ptr<asset_pack> pack{ new asset_pack };
+
+#if defined(_WIN32)
+    pack->file_ = ::CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    LARGE_INTEGER size{};
+    if (pack->file_ == INVALID_HANDLE_VALUE || !::GetFileSizeEx(pack->file_, &size)) {
+        throw std::runtime_error("Couldn't open the asset pack!");
+    }
+    pack->size_ = static_cast<std::size_t>(size.QuadPart);
+    if (pack->size_ < sizeof(internal::pack_header)) {
+        throw std::runtime_error("Not an asset pack!");
+    }
+    pack->mapping_ = ::CreateFileMappingW(pack->file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!pack->mapping_) {
+        throw std::runtime_error("Couldn't map the asset pack!");
+    }
+    pack->data_ =
+        static_cast<const std::byte*>(::MapViewOfFile(pack->mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!pack->data_) {
+        throw std::runtime_error("Couldn't map the asset pack!");
+    }
+#else
+    const auto file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        throw std::runtime_error("Couldn't open the asset pack!");
+    }
+    struct stat status {};
+    if (::fstat(file, &status) != 0 ||
+        static_cast<std::size_t>(status.st_size) < sizeof(internal::pack_header)) {
+        ::close(file);
+        throw std::runtime_error("Not an asset pack!");
+    }
+    pack->size_ = static_cast<std::size_t>(status.st_size);
+    // the mapping keeps the file, the descriptor is not needed any more.
+    auto* data = ::mmap(nullptr, pack->size_, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if (data == MAP_FAILED) {
+        pack->size_ = 0;
+        throw std::runtime_error("Couldn't map the asset pack!");
+    }
+    pack->data_ = static_cast<const std::byte*>(data);
+#endif
+
+    pack->validate();
+    pack->toc_ =
+        reinterpret_cast<const internal::pack_entry*>(pack->data_ + pack->header()->toc_offset);
+    pack->mask_ = pack->header()->bucket_count - 1;
+    return pack;
+}
+
+void ecs::asset_pack::validate() const {
+    const auto* header = this->header();
+    if (std::memcmp(header->magic, internal::pack_magic, sizeof(internal::pack_magic)) != 0 ||
+        header->version != internal::pack_version) {
+        throw std::runtime_error("Not an asset pack!");
+    }
+
+    const auto buckets = header->bucket_count;
+    if (!std::has_single_bit(header->alignment) || !std::has_single_bit(buckets) ||
+        header->entry_count >= buckets ||
+        header->toc_offset % alignof(internal::pack_entry) != 0 || header->toc_offset > size_ ||
+        buckets > (size_ - header->toc_offset) / sizeof(internal::pack_entry)) {
+        throw std::runtime_error("Broken asset pack!");
+    }
+
+    const std::span entries{
+        reinterpret_cast<const internal::pack_entry*>(data_ + header->toc_offset), buckets
+    };
+    std::uint64_t count = 0;
+    for (const auto& entry : entries) {
+        if (!entry.key_offset) {
+            continue;
+        }
+        ++count;
+        if (entry.key_size > size_ || entry.key_offset > size_ - entry.key_size ||
+            entry.blob_size > size_ || entry.blob_offset > size_ - entry.blob_size ||
+            entry.blob_offset % header->alignment != 0) {
+            throw std::runtime_error("Broken asset pack!");
+        }
+    }
+    if (count != header->entry_count) {
+        throw std::runtime_error("Broken asset pack!");
+    }
+}
+
+auto ecs::asset_pack::find(const std::string_view key) const noexcept
+    -> std::span<const std::byte> {
+    const auto hash = internal::pack_hash(key);
+    // there are more buckets than entries, the probe ends at an empty bucket.
+    for (auto index = hash & mask_;; index = (index + 1) & mask_) {
+        const auto& entry = toc_[index];
+        if (!entry.key_offset) {
+            return {};
+        }
+        if (entry.hash == hash && entry.key_size == key.size() &&
+            std::memcmp(data_ + entry.key_offset, key.data(), key.size()) == 0) {
+            return { data_ + entry.blob_offset, static_cast<std::size_t>(entry.blob_size) };
+        }
+    }
+}
+
+auto ecs::asset_pack::blob(const std::string_view key) const -> asset_blob {
+    const auto bytes = find(key);
+    if (!bytes.data()) {
+        return {};
+    }
+    // aliasing the pack, the bytes keep it mapped.
+    return { std::shared_ptr<const std::byte>{ shared_from_this(), bytes.data() }, bytes.size() };
+}
+
+ecs::asset_pack_writer::asset_pack_writer(const std::uint32_t alignment) : alignment_(alignment) {
+    if (!std::has_single_bit(alignment)) {
+        throw std::runtime_error("The alignment of an asset pack must be a power of two!");
+    }
+}
+
+void ecs::asset_pack_writer::add(std::string key, const std::span<const std::byte> bytes) {
+    if (key.empty()) {
+        throw std::runtime_error("Empty key in an asset pack!");
+    }
+    if (!indices_.try_emplace(key, entries_.size()).second) {
+        throw std::runtime_error("Duplicated key in an asset pack!");
+    }
+    entries_.emplace_back(std::move(key), vector<std::byte>{ bytes.begin(), bytes.end() });
+}
+
+void ecs::asset_pack_writer::add_file(std::string key, const std::filesystem::path& path) {
+    std::ifstream file{ path, std::ios::binary };
+    if (!file) {
+        throw std::runtime_error("Couldn't read an asset file!");
+    }
+    const vector<char> content{ std::istreambuf_iterator<char>{ file },
+                                std::istreambuf_iterator<char>{} };
+    add(std::move(key), std::as_bytes(std::span{ content }));
+}
+
+void ecs::asset_pack_writer::write(const std::filesystem::path& path) const {
+    const auto buckets = std::bit_ceil(std::max<std::uint64_t>(entries_.size() * 2, 2));
+
+    internal::pack_header header{};
+    std::memcpy(header.magic, internal::pack_magic, sizeof(header.magic));
+    header.version      = internal::pack_version;
+    header.alignment    = alignment_;
+    header.entry_count  = entries_.size();
+    header.bucket_count = buckets;
+    header.toc_offset   = align_up(sizeof(header), alignof(internal::pack_entry));
+
+    // keys follow the table of contents, then the blobs, in the order they were added.
+    vector<internal::pack_entry> toc(buckets);
+    vector<std::uint64_t> blob_offsets(entries_.size());
+    auto offset = header.toc_offset + buckets * sizeof(internal::pack_entry);
+    for (const auto& entry : entries_) {
+        offset += entry.key.size();
+    }
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+        offset          = align_up(offset, alignment_);
+        blob_offsets[i] = offset;
+        offset += entries_[i].bytes.size();
+    }
+
+    auto key_offset = header.toc_offset + buckets * sizeof(internal::pack_entry);
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+        const auto& entry = entries_[i];
+        const auto hash   = internal::pack_hash(entry.key);
+        auto index        = hash & (buckets - 1);
+        while (toc[index].key_offset) {
+            index = (index + 1) & (buckets - 1);
+        }
+        toc[index] = { hash, key_offset, entry.key.size(), blob_offsets[i], entry.bytes.size() };
+        key_offset += entry.key.size();
+    }
+
+    // processes that have the old pack mapped keep it, the new one is renamed over it when done.
+    auto temporary = path;
+    temporary += ".tmp";
+    std::ofstream file{ temporary, std::ios::binary | std::ios::trunc };
+    if (!file) {
+        throw std::runtime_error("Couldn't write the asset pack!");
+    }
+    auto write_bytes = [&file](const void* data, const std::size_t size) {
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+    const char zeros[64]{};
+    auto pad_to = [&](const std::uint64_t target) {
+        for (auto position = static_cast<std::uint64_t>(file.tellp()); position < target;) {
+            const auto count = std::min<std::uint64_t>(target - position, sizeof(zeros));
+            write_bytes(zeros, count);
+            position += count;
+        }
+    };
+
+    write_bytes(&header, sizeof(header));
+    pad_to(header.toc_offset);
+    write_bytes(toc.data(), toc.size() * sizeof(internal::pack_entry));
+    for (const auto& entry : entries_) {
+        write_bytes(entry.key.data(), entry.key.size());
+    }
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+        pad_to(blob_offsets[i]);
+        write_bytes(entries_[i].bytes.data(), entries_[i].bytes.size());
+    }
+    file.close();
+    std::error_code error;
+    if (!file) {
+        std::filesystem::remove(temporary, error);
+        throw std::runtime_error("Couldn't write the asset pack!");
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        throw std::runtime_error("Couldn't write the asset pack!");
+    }
+}
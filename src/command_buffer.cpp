@@ -0,0 +1,110 @@
+#include "command_buffer.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+using namespace atom;
+
+/*! @cond TURN_OFF_DOXYGEN */
+
+namespace {
+
+thread_local ecs::command_buffer* current_buffer = nullptr;
+
+constexpr auto align_up(const std::size_t value) noexcept -> std::size_t {
+    constexpr auto alignment = alignof(std::max_align_t);
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+/*! @endcond */
+
+ecs::command_buffer::scope::scope(command_buffer* buffer) noexcept
+    : previous_(std::exchange(current_buffer, buffer)) {}
+
+ecs::command_buffer::scope::~scope() noexcept { current_buffer = previous_; }
+
+ecs::command_buffer::command_buffer(command_buffer&& that) noexcept
+    : blocks_(std::move(that.blocks_)), block_(std::exchange(that.block_, 0)),
+      offset_(std::exchange(that.offset_, 0)), head_(std::exchange(that.head_, nullptr)),
+      tail_(std::exchange(that.tail_, nullptr)) {}
+
+auto ecs::command_buffer::operator=(command_buffer&& that) noexcept -> command_buffer& {
+    if (this != &that) {
+        clear();
+        blocks_ = std::move(that.blocks_);
+        block_  = std::exchange(that.block_, 0);
+        offset_ = std::exchange(that.offset_, 0);
+        head_   = std::exchange(that.head_, nullptr);
+        tail_   = std::exchange(that.tail_, nullptr);
+    }
+    return *this;
+}
+
+ecs::command_buffer::~command_buffer() noexcept { clear(); }
+
+auto ecs::command_buffer::current() noexcept -> command_buffer* { return current_buffer; }
+
+void ecs::command_buffer::apply() {
+    // the records change the world, even if the thread is recording into some buffer.
+    scope unscoped{ nullptr };
+    // the list is taken first, so the buffer is empty whether or not a record throws.
+    auto* record = std::exchange(head_, nullptr);
+    tail_        = nullptr;
+    try {
+        while (record) {
+            record->invoke(record);
+            auto* next = record->next;
+            record->destroy(record);
+            record = next;
+        }
+    }
+    catch (...) {
+        while (record) {
+            auto* next = record->next;
+            record->destroy(record);
+            record = next;
+        }
+        block_  = 0;
+        offset_ = 0;
+        throw;
+    }
+    block_  = 0;
+    offset_ = 0;
+}
+
+void ecs::command_buffer::clear() noexcept {
+    for (auto* record = head_; record;) {
+        auto* next = record->next;
+        record->destroy(record);
+        record = next;
+    }
+    head_   = nullptr;
+    tail_   = nullptr;
+    block_  = 0;
+    offset_ = 0;
+}
+
+auto ecs::command_buffer::allocate(const std::size_t size) -> void* {
+    const auto needed = align_up(size);
+    while (block_ < blocks_.size()) {
+        auto& current = blocks_[block_];
+        if (offset_ + needed <= current.size) {
+            auto* address = current.data.get() + offset_;
+            offset_ += needed;
+            return address;
+        }
+        ++block_;
+        offset_ = 0;
+    }
+
+    // each new block is twice the last one, and fits the record at least.
+    const auto last  = blocks_.empty() ? first_block_size / 2 : blocks_.back().size;
+    const auto bytes = std::max(last * 2, needed);
+    blocks_.push_back({ std::unique_ptr<std::byte[]>(new std::byte[bytes]), bytes });
+    block_  = blocks_.size() - 1;
+    offset_ = needed;
+    return blocks_.back().data.get();
+}
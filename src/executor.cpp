@@ -0,0 +1,118 @@
+#include "executor.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+using namespace atom;
+
+/*! @cond TURN_OFF_DOXYGEN */
+
+namespace {
+
+// the executor the calling thread works for, and its deque.
+struct worker_slot {
+    ecs::executor* owner;
+    std::size_t index;
+};
+
+thread_local worker_slot current{ nullptr, 0 };
+
+void run(ecs::executor::task& task) noexcept { task(); }
+
+} // namespace
+
+/*! @endcond */
+
+ecs::executor::executor(const std::size_t workers)
+    : count_(std::max<std::size_t>(workers, 1)),
+      workers_(std::make_unique<worker[]>(count_)), pending_(0), next_(0), stop_(false) {
+    for (std::size_t i = 0; i < count_; ++i) {
+        workers_[i].thread = std::thread([this, i] { work(i); });
+    }
+}
+
+ecs::executor::~executor() {
+    {
+        std::lock_guard guard{ sleep_mutex_ };
+        stop_ = true;
+    }
+    sleep_cv_.notify_all();
+    for (std::size_t i = 0; i < count_; ++i) {
+        workers_[i].thread.join();
+    }
+}
+
+void ecs::executor::submit(task task) {
+    const auto index = current.owner == this ? current.index : next_.fetch_add(1) % count_;
+    {
+        auto& worker = workers_[index];
+        std::lock_guard guard{ worker.mutex };
+        worker.tasks.emplace_back(std::move(task));
+        pending_.fetch_add(1);
+    }
+
+    // the sleepers check `pending_` under this lock, so the notification can't be lost.
+    { std::lock_guard guard{ sleep_mutex_ }; }
+    sleep_cv_.notify_one();
+}
+
+auto ecs::executor::try_run_one() -> bool {
+    auto task = current.owner == this ? pop(current.index) : executor::task{};
+    if (!task) {
+        task = steal(current.owner == this ? current.index + 1 : next_.fetch_add(1));
+    }
+    if (!task) {
+        return false;
+    }
+
+    run(task);
+    return true;
+}
+
+void ecs::executor::work(const std::size_t index) {
+    current = { this, index };
+    while (true) {
+        auto task = pop(index);
+        if (!task) {
+            task = steal(index + 1);
+        }
+        if (task) {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock lock{ sleep_mutex_ };
+        if (stop_ && !pending_) {
+            return;
+        }
+        sleep_cv_.wait(lock, [this] { return stop_ || pending_; });
+    }
+}
+
+auto ecs::executor::pop(const std::size_t index) -> task {
+    auto& worker = workers_[index];
+    std::lock_guard guard{ worker.mutex };
+    if (worker.tasks.empty()) {
+        return {};
+    }
+
+    auto task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    pending_.fetch_sub(1);
+    return task;
+}
+
+auto ecs::executor::steal(const std::size_t first) -> task {
+    for (std::size_t i = 0; i < count_; ++i) {
+        auto& victim = workers_[(first + i) % count_];
+        std::lock_guard guard{ victim.mutex };
+        if (!victim.tasks.empty()) {
+            auto task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pending_.fetch_sub(1);
+            return task;
+        }
+    }
+    return {};
+}
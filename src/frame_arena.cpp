@@ -0,0 +1,61 @@
+#include "frame_arena.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+using namespace atom;
+
+ecs::frame_arena::frame_arena() {
+    blocks_.emplace_back(std::make_unique<block>(
+        std::make_unique_for_overwrite<std::byte[]>(first_block_size), first_block_size, 0
+    ));
+    current_.store(blocks_.front().get(), std::memory_order_relaxed);
+}
+
+void ecs::frame_arena::reset() noexcept {
+    index_ = 0;
+    blocks_.front()->used.store(0, std::memory_order_relaxed);
+    current_.store(blocks_.front().get(), std::memory_order_release);
+}
+
+auto ecs::frame_arena::do_allocate(const std::size_t bytes, const std::size_t alignment)
+    -> void* {
+    // the padding is reserved in the worst case, so that a claimed range always fits.
+    const auto needed = bytes + alignment - 1;
+    while (true) {
+        auto* current = current_.load(std::memory_order_acquire);
+        const auto offset = current->used.fetch_add(needed, std::memory_order_relaxed);
+        if (offset + needed <= current->size) [[likely]] {
+            const auto address = reinterpret_cast<std::uintptr_t>(current->data.get() + offset);
+            const auto aligned = (address + alignment - 1) & ~(alignment - 1);
+            return current->data.get() + offset + (aligned - address);
+        }
+        advance(current, needed);
+    }
+}
+
+void ecs::frame_arena::advance(block* const full, const std::size_t bytes) {
+    std::lock_guard guard{ mutex_ };
+    if (current_.load(std::memory_order_relaxed) != full) {
+        // another thread moved on already.
+        return;
+    }
+
+    // blocks after the current one are left from earlier frames, the first that fits is reused.
+    while (++index_ < blocks_.size()) {
+        if (auto& next = blocks_[index_]; next->size >= bytes) {
+            next->used.store(0, std::memory_order_relaxed);
+            current_.store(next.get(), std::memory_order_release);
+            return;
+        }
+    }
+
+    const auto size = std::max(blocks_.back()->size * 2, bytes);
+    blocks_.emplace_back(
+        std::make_unique<block>(std::make_unique_for_overwrite<std::byte[]>(size), size, 0)
+    );
+    index_ = blocks_.size() - 1;
+    current_.store(blocks_.back().get(), std::memory_order_release);
+}
@@ -0,0 +1,208 @@
+#include "mask_filter.hpp"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include "signature.hpp"
+
+#if !defined(ATOM_ECS_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+                                   (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define ATOM_ECS_X86_SIMD
+    #include <immintrin.h>
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #include <intrin.h>
+        #define ATOM_ECS_TARGET_AVX2
+    #else
+        #define ATOM_ECS_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+using namespace atom;
+
+/*! @cond TURN_OFF_DOXYGEN */
+
+namespace {
+
+using word_type = ecs::signature::word_type;
+
+constexpr std::size_t word_count = ecs::signature::word_count;
+constexpr std::size_t block_bits = 64;
+
+// Each kernel returns one bit per entity of a block of up to 64 entities, set if it matches.
+
+auto match_scalar(
+    const ecs::signature* signatures,
+    const std::size_t count,
+    const ecs::signature& include,
+    const ecs::signature& exclude
+) noexcept -> std::uint64_t {
+    const auto& inc = include.words();
+    const auto& exc = exclude.words();
+    std::uint64_t result{};
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto& words = signatures[i].words();
+        word_type fail{};
+        for (std::size_t w = 0; w < word_count; ++w) {
+            fail |= ((words[w] & inc[w]) ^ inc[w]) | (words[w] & exc[w]);
+        }
+        result |= static_cast<std::uint64_t>(fail == 0) << i;
+    }
+    return result;
+}
+
+#ifdef ATOM_ECS_X86_SIMD
+
+auto match_sse2(
+    const ecs::signature* signatures,
+    const std::size_t count,
+    const ecs::signature& include,
+    const ecs::signature& exclude
+) noexcept -> std::uint64_t {
+    if constexpr (word_count % 2 != 0) {
+        return match_scalar(signatures, count, include, exclude);
+    }
+    else {
+        constexpr std::size_t lanes = word_count / 2;
+        // sized so that they are valid declarations even for widths this branch doesn't handle
+        __m128i inc[(word_count + 1) / 2];
+        __m128i exc[(word_count + 1) / 2];
+        for (std::size_t l = 0; l < lanes; ++l) {
+            inc[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(include.words().data()) + l);
+            exc[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(exclude.words().data()) + l);
+        }
+
+        const auto zero = _mm_setzero_si128();
+        std::uint64_t result{};
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto* words = reinterpret_cast<const __m128i*>(signatures[i].words().data());
+            auto fail         = zero;
+            for (std::size_t l = 0; l < lanes; ++l) {
+                const auto value = _mm_loadu_si128(words + l);
+                fail = _mm_or_si128(fail, _mm_andnot_si128(value, inc[l]));
+                fail = _mm_or_si128(fail, _mm_and_si128(value, exc[l]));
+            }
+            const bool matched = _mm_movemask_epi8(_mm_cmpeq_epi8(fail, zero)) == 0xFFFF;
+            result |= static_cast<std::uint64_t>(matched) << i;
+        }
+        return result;
+    }
+}
+
+ATOM_ECS_TARGET_AVX2 auto match_avx2(
+    const ecs::signature* signatures,
+    const std::size_t count,
+    const ecs::signature& include,
+    const ecs::signature& exclude
+) noexcept -> std::uint64_t {
+    if constexpr (word_count % 4 != 0) {
+        return match_sse2(signatures, count, include, exclude);
+    }
+    else {
+        constexpr std::size_t lanes = word_count / 4;
+        __m256i inc[(word_count + 3) / 4];
+        __m256i exc[(word_count + 3) / 4];
+        for (std::size_t l = 0; l < lanes; ++l) {
+            inc[l] =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(include.words().data()) + l);
+            exc[l] =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(exclude.words().data()) + l);
+        }
+
+        std::uint64_t result{};
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto* words = reinterpret_cast<const __m256i*>(signatures[i].words().data());
+            auto fail         = _mm256_setzero_si256();
+            for (std::size_t l = 0; l < lanes; ++l) {
+                const auto value = _mm256_loadu_si256(words + l);
+                fail = _mm256_or_si256(fail, _mm256_andnot_si256(value, inc[l]));
+                fail = _mm256_or_si256(fail, _mm256_and_si256(value, exc[l]));
+            }
+            result |= static_cast<std::uint64_t>(_mm256_testz_si256(fail, fail)) << i;
+        }
+        return result;
+    }
+}
+
+auto cpu_has_avx2() noexcept -> bool {
+    #if defined(_MSC_VER) && !defined(__clang__)
+    int info[4]{};
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // the os saves the ymm registers
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+    #else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+    #endif
+}
+
+#endif
+
+auto choose() noexcept -> ecs::mask_filter::kernel {
+#ifdef ATOM_ECS_X86_SIMD
+    if (word_count % 4 == 0 && cpu_has_avx2()) {
+        return ecs::mask_filter::kernel::avx2;
+    }
+    if (word_count % 2 == 0) {
+        return ecs::mask_filter::kernel::sse2;
+    }
+#endif
+    return ecs::mask_filter::kernel::scalar;
+}
+
+using match_fn = std::uint64_t (*)(
+    const ecs::signature*, std::size_t, const ecs::signature&, const ecs::signature&
+) noexcept;
+
+auto matcher() noexcept -> match_fn {
+    switch (ecs::mask_filter::active()) {
+#ifdef ATOM_ECS_X86_SIMD
+    case ecs::mask_filter::kernel::avx2:
+        return &match_avx2;
+    case ecs::mask_filter::kernel::sse2:
+        return &match_sse2;
+#endif
+    default:
+        return &match_scalar;
+    }
+}
+
+} // namespace
+
+/*! @endcond */
+
+auto ecs::mask_filter::active() noexcept -> kernel {
+    static const kernel chosen = choose();
+    return chosen;
+}
+
+void ecs::mask_filter::select(
+    const signature* signatures,
+    const std::uint64_t* alive,
+    const std::size_t count,
+    const signature& include,
+    const signature& exclude,
+    vector<entity::index_t>& output
+) {
+    static const match_fn match = matcher();
+
+    for (std::size_t first = 0; first < count; first += block_bits) {
+        const auto block = alive[first / block_bits];
+        if (!block) {
+            continue;
+        }
+
+        const auto size = count - first < block_bits ? count - first : block_bits;
+        for (auto bits = block & match(signatures + first, size, include, exclude); bits;
+             bits &= bits - 1) {
+            output.emplace_back(static_cast<entity::index_t>(first + std::countr_zero(bits)));
+        }
+    }
+}
@@ -1,5 +1,8 @@
 #include "schedule.hpp"
+#include <algorithm>
+#include <thread>
 #include <memory/pool.hpp>
+#include "executor.hpp"
 #include "thread/thread_pool.hpp"
 
 auto atom::ecs::scheduler::synchronized_pool() noexcept -> atom::utils::synchronized_pool* {
@@ -11,3 +14,8 @@ auto atom::ecs::scheduler::thread_pool() noexcept -> atom::utils::thread_pool& {
     static atom::utils::thread_pool pool;
     return pool;
 }
+
+auto atom::ecs::scheduler::executor() noexcept -> ::atom::ecs::executor& {
+    static ::atom::ecs::executor executor{ std::max(std::thread::hardware_concurrency(), 2U) - 1 };
+    return executor;
+}
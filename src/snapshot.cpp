@@ -0,0 +1,651 @@
+#include "snapshot.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "archetype.hpp"
+#include "containers.hpp"
+#include "ecs.hpp"
+#include "entity_set.hpp"
+#include "query.hpp"
+#include "world.hpp"
+
+using namespace atom;
+
+namespace {
+
+constexpr char snapshot_magic[8]         = { 'A', 'T', 'O', 'M', 'S', 'N', 'A', 'P' };
+constexpr std::uint32_t snapshot_version = 1;
+constexpr std::uint64_t block_alignment  = 64;
+constexpr std::uint64_t read_chunk       = 64 * 1024;
+constexpr std::uint64_t max_object_size  = std::uint64_t{ 1 } << 31;
+
+/**
+ * @brief Header at the start of a snapshot.
+ *
+ * It is followed by the generations, the alive words and the free indices of the entities, then
+ * the sparse sets, the archetypes and the resources. Numbers are in the byte order of the machine
+ * that wrote the snapshot.
+ */
+struct snapshot_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t alignment;
+    std::uint64_t index_count;
+    std::uint64_t free_count;
+    std::uint64_t storage_count;
+    std::uint64_t archetype_count;
+    std::uint64_t resource_count;
+};
+
+// a type of component in a sparse set or an archetype.
+struct type_record {
+    std::uint64_t hash;
+    // size of an object of a raw type, zero for serialized ones.
+    std::uint64_t size;
+};
+
+struct snapshot_registry {
+    std::mutex mutex;
+    ecs::vector<const ecs::snapshot_component*> components;
+    ecs::vector<const ecs::snapshot_resource*> resources;
+};
+
+auto registry() -> snapshot_registry& {
+    static snapshot_registry instance;
+    return instance;
+}
+
+[[nodiscard]] auto broken() -> std::runtime_error {
+    return std::runtime_error("Broken world snapshot!");
+}
+
+class snapshot_writer {
+public:
+    explicit snapshot_writer(std::ostream& out) noexcept : out_(out) {}
+
+    void bytes(const void* data, const std::size_t size) {
+        out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        offset_ += size;
+    }
+
+    template <typename Type>
+    void value(const Type& value) {
+        bytes(&value, sizeof(Type));
+    }
+
+    // raw blocks start at multiples of the alignment, so a mapped snapshot could be used as is.
+    void block(const void* data, const std::size_t size) {
+        constexpr char zeros[block_alignment]{};
+        bytes(zeros, (block_alignment - offset_ % block_alignment) % block_alignment);
+        bytes(data, size);
+    }
+
+    // serialized objects are prefixed by their length, so unknown types could be skipped.
+    template <typename Save>
+    void serialized(Save&& save) {
+        std::ostringstream stream{ std::ios::binary };
+        save(stream);
+        const auto content = std::move(stream).str();
+        value(static_cast<std::uint64_t>(content.size()));
+        bytes(content.data(), content.size());
+    }
+
+    void check() const {
+        if (!out_) {
+            throw std::runtime_error("Couldn't write the world snapshot!");
+        }
+    }
+
+private:
+    std::ostream& out_;
+    std::uint64_t offset_{};
+};
+
+class snapshot_reader {
+public:
+    explicit snapshot_reader(std::istream& in) noexcept : in_(in) {}
+
+    void bytes(void* data, const std::size_t size) {
+        if (!in_.read(static_cast<char*>(data), static_cast<std::streamsize>(size))) {
+            throw broken();
+        }
+        offset_ += size;
+    }
+
+    template <typename Type>
+    auto value() -> Type {
+        Type value;
+        bytes(&value, sizeof(Type));
+        return value;
+    }
+
+    void block(void* data, const std::size_t size) {
+        pad();
+        bytes(data, size);
+    }
+
+    template <typename Type>
+    auto block(const std::uint64_t count) -> ecs::vector<Type> {
+        ecs::vector<Type> values;
+        pad();
+        chunks(values, count);
+        return values;
+    }
+
+    void skip_block(const std::size_t size) {
+        pad();
+        skip(size);
+    }
+
+    // a stream of its own, so a serializer never reads past its objects.
+    auto serialized() -> std::istringstream {
+        std::string content;
+        chunks(content, value<std::uint64_t>());
+        return std::istringstream{ std::move(content), std::ios::binary };
+    }
+
+    void skip_serialized() { skip(value<std::uint64_t>()); }
+
+private:
+    // counts come from the stream, so memory grows with what has been read. A broken count fails
+    // at the end of the stream instead of allocating it all up front.
+    template <typename Container>
+    void chunks(Container& values, const std::uint64_t count) {
+        using value_type        = typename Container::value_type;
+        constexpr auto per_read = std::max<std::uint64_t>(read_chunk / sizeof(value_type), 1);
+        for (std::uint64_t done = 0; done < count;) {
+            const auto next = std::min(count - done, per_read);
+            values.resize(static_cast<std::size_t>(done + next));
+            bytes(values.data() + done, static_cast<std::size_t>(next * sizeof(value_type)));
+            done += next;
+        }
+    }
+
+    void pad() { skip((block_alignment - offset_ % block_alignment) % block_alignment); }
+
+    void skip(const std::uint64_t size) {
+        if (size > static_cast<std::uint64_t>(std::numeric_limits<std::streamsize>::max())) {
+            throw broken();
+        }
+        const auto count = static_cast<std::streamsize>(size);
+        if (!in_.ignore(count) || in_.gcount() != count) {
+            throw broken();
+        }
+        offset_ += size;
+    }
+
+    std::istream& in_;
+    std::uint64_t offset_{};
+};
+
+void write_ids(
+    snapshot_writer& output,
+    const ecs::vector<ecs::entity::id_t>& entities,
+    const ecs::vector<std::uint32_t>& rows
+) {
+    ecs::vector<ecs::entity::id_t> ids;
+    ids.reserve(rows.size());
+    for (const auto row : rows) {
+        ids.emplace_back(entities[row]);
+    }
+    output.block(ids.data(), ids.size() * sizeof(ecs::entity::id_t));
+}
+
+// objects in `rows` of `count` packed ones.
+void write_objects(
+    snapshot_writer& output,
+    const ecs::snapshot_component* type,
+    const void* objects,
+    const std::size_t count,
+    const ecs::vector<std::uint32_t>& rows
+) {
+    const auto* bytes = static_cast<const std::byte*>(objects);
+    const auto size   = type->size;
+    const auto all    = rows.size() == count;
+    if (type->raw && all) {
+        output.block(objects, count * size);
+    }
+    else if (type->raw) {
+        ecs::vector<std::byte> gathered(rows.size() * size);
+        for (std::size_t i = 0; i < rows.size(); ++i) {
+            std::memcpy(gathered.data() + i * size, bytes + rows[i] * size, size);
+        }
+        output.block(gathered.data(), gathered.size());
+    }
+    else {
+        output.serialized([&](std::ostream& stream) {
+            if (all) {
+                type->save(stream, objects, count);
+                return;
+            }
+            for (const auto row : rows) {
+                type->save(stream, bytes + row * size, 1);
+            }
+        });
+    }
+}
+
+} // namespace
+
+auto ecs::internal::enroll(const snapshot_component* type) -> bool {
+    auto& instance = registry();
+    std::lock_guard guard{ instance.mutex };
+    if (std::ranges::find(instance.components, type) == instance.components.end()) {
+        instance.components.emplace_back(type);
+    }
+    return true;
+}
+
+auto ecs::internal::enroll(const snapshot_resource* type) -> bool {
+    auto& instance = registry();
+    std::lock_guard guard{ instance.mutex };
+    if (std::ranges::find(instance.resources, type) == instance.resources.end()) {
+        instance.resources.emplace_back(type);
+    }
+    return true;
+}
+
+auto ecs::internal::snapshot_components() -> vector<const snapshot_component*> {
+    auto& instance = registry();
+    std::lock_guard guard{ instance.mutex };
+    return instance.components;
+}
+
+auto ecs::internal::snapshot_resources() -> vector<const snapshot_resource*> {
+    auto& instance = registry();
+    std::lock_guard guard{ instance.mutex };
+    return instance.resources;
+}
+
+void ecs::world::save(std::ostream& out) const {
+    vector<const snapshot_component*> types;
+    for (const auto* type : internal::snapshot_components()) {
+        const auto id = type->index();
+        if (id >= types.size()) {
+            types.resize(static_cast<std::size_t>(id) + 1);
+        }
+        types[id] = type;
+    }
+    const auto type_of = [&types](const component::id_t id) -> const snapshot_component* {
+        return id < types.size() && types[id] && types[id]->savable ? types[id] : nullptr;
+    };
+    // killed entities keep their components until the next garbage collection.
+    const auto alive_rows = [this](const vector<entity::id_t>& entities) {
+        vector<std::uint32_t> rows;
+        rows.reserve(entities.size());
+        for (std::uint32_t row = 0; row < entities.size(); ++row) {
+            if (entities_.contains(entities[row])) {
+                rows.emplace_back(row);
+            }
+        }
+        return rows;
+    };
+
+    vector<std::pair<component::id_t, vector<std::uint32_t>>> storages;
+    for (std::size_t id = 0; id < component_storage_.size(); ++id) {
+        const auto* storage = std::get<0>(component_storage_[id]);
+        if (storage && !storage->empty() && type_of(static_cast<component::id_t>(id))) {
+            if (auto rows = alive_rows(storage->entities()); !rows.empty()) {
+                storages.emplace_back(static_cast<component::id_t>(id), std::move(rows));
+            }
+        }
+    }
+
+    // columns of each archetype, the serialized ones first, see `load`.
+    struct table_record {
+        const archetype* table;
+        vector<component::id_t> columns;
+        vector<std::uint32_t> rows;
+    };
+    vector<table_record> tables;
+    for (const auto& table : archetypes_.archetypes()) {
+        if (!table->size()) {
+            continue;
+        }
+        vector<component::id_t> columns;
+        for (const auto id : table->components()) {
+            if (const auto* type = type_of(id); type && !type->raw) {
+                columns.emplace_back(id);
+            }
+        }
+        for (const auto id : table->components()) {
+            if (const auto* type = type_of(id); type && type->raw) {
+                columns.emplace_back(id);
+            }
+        }
+        if (auto rows = alive_rows(table->entities()); !columns.empty() && !rows.empty()) {
+            tables.emplace_back(table.get(), std::move(columns), std::move(rows));
+        }
+    }
+
+    vector<const snapshot_resource*> resources;
+    for (const auto* type : internal::snapshot_resources()) {
+        if (type->savable && type->slot(resources_).get()) {
+            resources.emplace_back(type);
+        }
+    }
+
+    // indices waiting for the garbage collection are saved as released.
+    auto generations = entities_.generations();
+    auto free        = entities_.free_indices();
+    for (const auto index : pending_destroy_) {
+        ++generations[index];
+        free.emplace_back(index);
+    }
+
+    snapshot_writer output{ out };
+    snapshot_header header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version         = snapshot_version;
+    header.alignment       = block_alignment;
+    header.index_count     = generations.size();
+    header.free_count      = free.size();
+    header.storage_count   = storages.size();
+    header.archetype_count = tables.size();
+    header.resource_count  = resources.size();
+    output.value(header);
+
+    const auto& alive = entities_.alive_words();
+    output.block(generations.data(), generations.size() * sizeof(entity::generation_t));
+    output.block(alive.data(), alive.size() * sizeof(alive.front()));
+    output.block(free.data(), free.size() * sizeof(entity::index_t));
+
+    for (const auto& [id, rows] : storages) {
+        const auto* type    = types[id];
+        const auto* storage = std::get<0>(component_storage_[id]);
+        output.value(type_record{ type->hash, type->raw ? type->size : 0 });
+        output.value(static_cast<std::uint64_t>(rows.size()));
+        write_ids(output, storage->entities(), rows);
+        write_objects(output, type, type->packed(storage), storage->size(), rows);
+    }
+
+    for (const auto& [table, columns, rows] : tables) {
+        output.value(static_cast<std::uint64_t>(columns.size()));
+        output.value(static_cast<std::uint64_t>(rows.size()));
+        for (const auto id : columns) {
+            output.value(type_record{ types[id]->hash, types[id]->raw ? types[id]->size : 0 });
+        }
+        write_ids(output, table->entities(), rows);
+        for (const auto id : columns) {
+            write_objects(output, types[id], table->find(id)->at(0), table->size(), rows);
+        }
+    }
+
+    for (const auto* type : resources) {
+        output.value(static_cast<std::uint64_t>(type->hash));
+        output.serialized([&](std::ostream& stream) {
+            type->save(stream, type->slot(resources_).get());
+        });
+    }
+
+    output.check();
+}
+
+void ecs::world::load(std::istream& in) {
+    const auto reset = [this] {
+        for (auto& [storage, reflected] : component_storage_) {
+            if (storage) {
+                storage->clear();
+            }
+        }
+        archetypes_.clear();
+        pending_destroy_.clear();
+        for (auto& removals : removed_) {
+            removals.clear();
+        }
+        for (auto& [hash, query] : cached_queries_) {
+            query->clear();
+        }
+        const entity::generation_t generation{};
+        const std::uint64_t alive{};
+        entities_.assign({ &generation, 1 }, { &alive, 1 }, {});
+    };
+
+    unordered_map<std::size_t, const snapshot_component*> types;
+    for (const auto* type : internal::snapshot_components()) {
+        if (type->savable) {
+            types.emplace(type->hash, type);
+        }
+    }
+    // the type of a record, if this process knows it and stores it the same way.
+    const auto type_of = [&types](const type_record& record, const bool table) {
+        const auto iter = types.find(record.hash);
+        if (iter == types.end() || (iter->second->traits != nullptr) != table ||
+            record.size != (iter->second->raw ? iter->second->size : 0)) {
+            return static_cast<const snapshot_component*>(nullptr);
+        }
+        return iter->second;
+    };
+
+    vector<std::pair<const snapshot_resource*, std::shared_ptr<void>>> loaded;
+    try {
+        snapshot_reader input{ in };
+        const auto header = input.value<snapshot_header>();
+        if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 ||
+            header.version != snapshot_version || header.alignment != block_alignment) {
+            throw std::runtime_error("Not a world snapshot!");
+        }
+        constexpr std::uint64_t max_indices = std::uint64_t{ 1 } << 32;
+        if (!header.index_count || header.index_count > max_indices ||
+            header.free_count > header.index_count) {
+            throw broken();
+        }
+
+        constexpr std::uint64_t word_bits = sizeof(std::uint64_t) * 8;
+        const auto words       = (header.index_count + word_bits - 1) / word_bits;
+        const auto generations = input.block<entity::generation_t>(header.index_count);
+        const auto alive       = input.block<std::uint64_t>(words);
+        const auto free        = input.block<entity::index_t>(header.free_count);
+        const auto is_alive    = [&alive](const std::uint64_t index) {
+            return (alive[index / word_bits] >> (index % word_bits)) & 1U;
+        };
+        // index 0 is reserved, and no bit past the last index may be set.
+        if (is_alive(0) || (header.index_count % word_bits &&
+                            alive.back() >> (header.index_count % word_bits))) {
+            throw broken();
+        }
+        // an index listed twice would be handed to two entities.
+        vector<std::uint64_t> released(words);
+        for (const auto index : free) {
+            if (!index || index >= header.index_count || is_alive(index)) {
+                throw broken();
+            }
+            auto& word      = released[index / word_bits];
+            const auto mask = std::uint64_t{ 1 } << (index % word_bits);
+            if (word & mask) {
+                throw broken();
+            }
+            word |= mask;
+        }
+
+        reset();
+        entities_.assign(generations, alive, free);
+        const auto tick = advance_tick();
+
+        const auto read_entities = [&](const std::uint64_t count) {
+            if (count > entities_.size()) {
+                throw broken();
+            }
+            auto entities = input.block<entity::id_t>(count);
+            for (const auto entity : entities) {
+                if (!entities_.contains(entity)) {
+                    throw broken();
+                }
+            }
+            return entities;
+        };
+        // raw sizes are bounded, so skipping the objects of an unknown type can't overflow.
+        const auto read_record = [&input] {
+            const auto record = input.value<type_record>();
+            if (record.size > max_object_size) {
+                throw broken();
+            }
+            return record;
+        };
+        // a component appears once per entity.
+        const auto mark = [this](std::span<const entity::id_t> entities, const component::id_t id) {
+            for (const auto entity : entities) {
+                const auto index = static_cast<entity::index_t>(entity >> magic_32);
+                auto& signature  = entities_.signature_of(index);
+                if (signature.test(id)) {
+                    throw broken();
+                }
+                signature.set(id);
+            }
+        };
+
+        for (std::uint64_t i = 0; i < header.storage_count; ++i) {
+            const auto record   = read_record();
+            const auto entities = read_entities(input.value<std::uint64_t>());
+            const auto count    = entities.size();
+            const auto* type    = type_of(record, false);
+            if (!type) {
+                record.size ? input.skip_block(count * record.size) : input.skip_serialized();
+                continue;
+            }
+
+            const auto id = type->index();
+            if (id >= component_storage_.size()) {
+                component_storage_.resize(static_cast<std::size_t>(id) + 1);
+            }
+            auto& [storage, reflected] = component_storage_[id];
+            if (!storage) {
+                storage   = type->make_storage();
+                reflected = type->make_reflected();
+            }
+
+            mark(entities, id);
+            if (type->raw) {
+                input.block(type->append(storage, entities), count * type->size);
+            }
+            else {
+                auto stream = input.serialized();
+                auto values = type->load(stream, count);
+                type->emplace(storage, entities, values.get());
+            }
+            std::ranges::fill(storage->ticks(), component_ticks{ tick, tick });
+        }
+
+        for (std::uint64_t i = 0; i < header.archetype_count; ++i) {
+            const auto column_count = input.value<std::uint64_t>();
+            const auto count        = input.value<std::uint64_t>();
+            if (column_count > max_components) {
+                throw broken();
+            }
+            vector<type_record> records(column_count);
+            for (auto& record : records) {
+                record = read_record();
+            }
+            const auto entities = read_entities(count);
+            for (const auto entity : entities) {
+                const auto index = static_cast<entity::index_t>(entity >> magic_32);
+                if (archetypes_.locate(index).table) {
+                    throw broken();
+                }
+            }
+
+            // serialized columns come first, they are read before the rows are made.
+            vector<const snapshot_component*> columns(column_count);
+            vector<std::shared_ptr<void>> values(column_count);
+            vector<component::id_t> ids;
+            vector<const column_traits*> traits;
+            auto raw = records.begin();
+            for (; raw != records.end() && !raw->size; ++raw) {
+                const auto column = static_cast<std::size_t>(raw - records.begin());
+                if (const auto* type = type_of(*raw, true)) {
+                    auto stream     = input.serialized();
+                    values[column]  = type->load(stream, count);
+                    columns[column] = type;
+                }
+                else {
+                    input.skip_serialized();
+                }
+            }
+            for (auto record = raw; record != records.end(); ++record) {
+                if (!record->size) {
+                    throw broken();
+                }
+                columns[record - records.begin()] = type_of(*record, true);
+            }
+            for (const auto* type : columns) {
+                if (type) {
+                    ids.emplace_back(type->index());
+                    traits.emplace_back(type->traits);
+                }
+            }
+
+            archetype* table = nullptr;
+            std::uint32_t first{};
+            if (!ids.empty()) {
+                for (const auto id : ids) {
+                    mark(entities, id);
+                }
+                table = archetypes_.archetype_of(ids, traits);
+                first = archetypes_.append(table, entities);
+            }
+            for (std::size_t column = 0; column < columns.size(); ++column) {
+                const auto* type = columns[column];
+                if (!type) {
+                    if (records[column].size) {
+                        input.skip_block(count * records[column].size);
+                    }
+                }
+                else if (type->raw) {
+                    input.block(table->find(type->index())->at(first), count * type->size);
+                }
+                else {
+                    type->place(values[column].get(), table->find(type->index())->at(first));
+                }
+            }
+        }
+
+        for (const auto& table : archetypes_.archetypes()) {
+            for (auto& column : table->columns()) {
+                std::fill_n(column.ticks(), column.size(), component_ticks{ tick, tick });
+            }
+        }
+
+        // resources are replaced once the whole snapshot has been read.
+        const auto resources = internal::snapshot_resources();
+        for (std::uint64_t i = 0; i < header.resource_count; ++i) {
+            const auto hash = input.value<std::uint64_t>();
+            auto stream     = input.serialized();
+            const auto type = std::ranges::find_if(resources, [hash](const auto* type) {
+                return type->savable && type->hash == hash;
+            });
+            if (type != resources.end()) {
+                loaded.emplace_back(*type, (*type)->load(stream));
+            }
+        }
+    }
+    catch (...) {
+        reset();
+        throw;
+    }
+
+    for (const auto& [type, value] : loaded) {
+        type->assign(type->slot(resources_), value.get());
+    }
+
+    auto has = [this](const component::id_t id, const entity::index_t index) {
+        return contains(id, index);
+    };
+    for (auto& [hash, query] : cached_queries_) {
+        for (const auto entity : entities_) {
+            query->refresh(entity, has);
+        }
+    }
+}
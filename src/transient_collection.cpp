@@ -0,0 +1,29 @@
+#include "transient_collection.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+using namespace atom;
+
+ecs::basic_event_channel::basic_event_channel() noexcept {
+    static std::atomic<std::uint64_t> counter;
+    id_ = counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+ecs::transient_collection::transient_collection()
+    : channels_(std::make_unique<std::atomic<basic_event_channel*>[]>(max_events)) {}
+
+ecs::transient_collection::~transient_collection() noexcept {
+    for (std::size_t i = 0; i < max_events; ++i) {
+        delete channels_[i].load(std::memory_order_acquire);
+    }
+}
+
+void ecs::transient_collection::swap() noexcept {
+    for (std::size_t i = 0; i < max_events; ++i) {
+        if (auto* channel = channels_[i].load(std::memory_order_acquire)) {
+            channel->swap();
+        }
+    }
+}
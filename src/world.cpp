@@ -1,9 +1,8 @@
 #include "world.hpp"
-#include <latch>
+#include <algorithm>
 #include <memory/allocator.hpp>
 #include <memory/pool.hpp>
 #include <reflection.hpp>
-#include <thread/thread_pool.hpp>
 #include "command.hpp"
 #include "ecs.hpp"
 #include "queryer.hpp"
@@ -12,6 +11,12 @@
 
 using namespace atom;
 
+/*! @cond TURN_OFF_DOXYGEN */
+static constexpr auto is_main_thread(const ecs::priority priority) noexcept -> bool {
+    return priority == ecs::early_main_thread || priority == ecs::late_main_thread;
+}
+/*! @endcond */
+
 struct atom::ecs::command::command_attorney {
     static inline void update_garbage_collect(command& command) {
         command.update_garbage_collect();
@@ -23,7 +28,10 @@ struct atom::ecs::command::command_attorney {
     }
 };
 
-ecs::world::world() : shutdown_(false), generations_(1, 0) {};
+ecs::world::world()
+    : shutdown_(false), change_tick_(0),
+      garbage_collect_(&resources_.slot<resources::garbage_collect::enable_garbage_collect>()),
+      removed_(max_components) {};
 
 ecs::world::~world() {
     if (!shutdown_) {
@@ -31,18 +39,22 @@ ecs::world::~world() {
     }
 }
 
-void ecs::world::add_startup(void (*func)(ecs::command&, ecs::queryer&), const priority priority) {
-    startup_systems_.emplace(priority, func);
+void ecs::world::add_startup(
+    void (*func)(ecs::command&, ecs::queryer&), const priority priority, system_access access
+) {
+    startup_systems_.add(func, priority, is_main_thread(priority), std::move(access));
 }
 
 void ecs::world::add_update(
-    void (*func)(ecs::command&, ecs::queryer&, float), const priority priority
+    void (*func)(ecs::command&, ecs::queryer&, float), const priority priority, system_access access
 ) {
-    update_systems_.emplace(priority, func);
+    update_systems_.add(func, priority, is_main_thread(priority), std::move(access));
 }
 
-void ecs::world::add_shutdown(void (*func)(ecs::command&, ecs::queryer&), const priority priority) {
-    shutdown_systems_.emplace(priority, func);
+void ecs::world::add_shutdown(
+    void (*func)(ecs::command&, ecs::queryer&), const priority priority, system_access access
+) {
+    shutdown_systems_.add(func, priority, is_main_thread(priority), std::move(access));
 }
 
 /*! @cond TURN_OFF_DOXYGEN */
@@ -53,65 +65,40 @@ ATOM_RELEASE_INLINE static void startup_garbage_collect(ecs::command& command) {
 }
 
 ATOM_RELEASE_INLINE static void update_garbage_collect(
-    ::atom::ecs::command& command, ::atom::ecs::queryer& queryer
+    ::atom::ecs::command& command,
+    const ecs::res_mut<resources::garbage_collect::enable_garbage_collect> enable
 ) {
-    auto* penable = queryer.find<resources::garbage_collect::enable_garbage_collect>();
-    if (!penable) [[unlikely]] {
+    if (!enable) [[unlikely]] {
         command.add<resources::garbage_collect::enable_garbage_collect>(false);
+        return;
     }
 
-    if (penable->value) [[unlikely]] {
+    if (enable->value) [[unlikely]] {
         ::atom::ecs::command::command_attorney::update_garbage_collect(command);
     }
 }
 
-template <typename Systems, typename... Args>
-ATOM_RELEASE_INLINE static void call_each_system(Systems& systems, Args&... args) {
-#ifndef ATOM_SINGLE_THREAD
-    auto& thread_pool = ECS scheduler::thread_pool();
-    for (auto iter = systems.crbegin(); iter != systems.crend();) {
-        auto key         = iter->first;
-        const auto count = systems.count(key);
-        if (key != ecs::late_main_thread && key != ecs::early_main_thread) {
-            std::latch latch(static_cast<std::ptrdiff_t>(count));
-            for (auto i = 0; i < count; ++i) {
-                auto backup = iter;
-                auto fn     = [&latch, backup](Args&... args) {
-                    backup->second(args...);
-                    latch.count_down();
-                };
-                std::ignore = thread_pool.enqueue(fn, args...);
-                ++iter;
-            }
-            latch.wait();
-        }
-        else {
-            for (auto i = 0; i < count; ++i) {
-                iter->second(args...);
-                ++iter;
-            }
-        }
-    }
-#else
-    for (auto iter = systems.crbegin(); iter != systems.crend(); ++iter) {
-        iter->second(args...);
-    }
-#endif
-}
 /*! @endcond */
 
 void ::atom::ecs::world::startup() {
     auto command = ::atom::ecs::command{ this };
     auto queryer = ::atom::ecs::queryer{ this };
-    call_each_system(startup_systems_, command, queryer);
+    startup_systems_.run(queryer);
     startup_garbage_collect(command);
 }
 
 void ::atom::ecs::world::update(float delta_time) {
     auto command = ::atom::ecs::command{ this };
     auto queryer = ::atom::ecs::queryer{ this };
-    call_each_system(update_systems_, command, queryer, delta_time);
-    update_garbage_collect(command, queryer);
+    events_.swap();
+    prune_removals();
+    if (change_tick() - last_clamp_tick_ >= tick_clamp_interval) [[unlikely]] {
+        clamp_ticks();
+    }
+    update_systems_.run(queryer, delta_time);
+    update_garbage_collect(command, garbage_collect_);
+    frame_ ^= 1U;
+    frames_[frame_].reset();
 }
 
 void ::atom::ecs::world::shutdown() {
@@ -119,11 +106,47 @@ void ::atom::ecs::world::shutdown() {
         shutdown_    = true;
         auto command = ::atom::ecs::command{ this };
         auto queryer = ::atom::ecs::queryer{ this };
-        call_each_system(shutdown_systems_, command, queryer);
+        shutdown_systems_.run(queryer);
         command::command_attorney::shutdown_garbage_collect(command);
     }
 }
 
+void ::atom::ecs::world::prune_removals() {
+    for (auto& removals : removed_) {
+        std::erase_if(removals, [this](const auto& removal) {
+            return !is_newer(removal.second, last_update_tick_);
+        });
+    }
+    last_update_tick_ = change_tick();
+}
+
+void ::atom::ecs::world::clamp_ticks() {
+    const auto current = change_tick();
+    const auto clamp   = [current](component_ticks& ticks) {
+        ticks = { clamp_tick(ticks.added, current), clamp_tick(ticks.changed, current) };
+    };
+    for (auto& [storage, reflected] : component_storage_) {
+        if (storage) {
+            std::ranges::for_each(storage->ticks(), clamp);
+        }
+    }
+    for (const auto& table : archetypes_.archetypes()) {
+        for (auto& column : table->columns()) {
+            std::for_each(column.ticks(), column.ticks() + column.size(), clamp);
+        }
+    }
+    for (auto& removals : removed_) {
+        for (auto& removal : removals) {
+            removal.second = clamp_tick(removal.second, current);
+        }
+    }
+    last_update_tick_ = clamp_tick(last_update_tick_, current);
+    startup_systems_.clamp_ticks(current);
+    update_systems_.clamp_ticks(current);
+    shutdown_systems_.clamp_ticks(current);
+    last_clamp_tick_ = current;
+}
+
 auto ::atom::ecs::world::query() noexcept -> ::atom::ecs::queryer {
     return ::atom::ecs::queryer{ this };
 }
@@ -1,19 +1,39 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <exception>
+#include <filesystem>
 #include <format>
+#include <fstream>
 #include <iostream>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include <core.hpp>
 #include <core/pipeline.hpp>
 #include <memory/pool.hpp>
 #include <ranges/to.hpp>
 #include "asset.hpp"
+#include "asset_pack.hpp"
 #include "command.hpp"
 #include "ecs.hpp"
 #include "generator.hpp"
 #include "queryer.hpp"
 #include "resources.hpp"
+#include "snapshot.hpp"
 #include "world.hpp"
 
 using namespace atom::utils;
@@ -22,6 +42,35 @@ using namespace atom::ecs;
 const auto print   = [](const auto&... val) { ((std::cout << val << ' '), ...); };
 const auto println = [](const auto& val) { std::cout << val << '\n'; };
 const auto newline = []() { std::cout << '\n'; };
+const auto check   = [](const bool condition, const char* what) {
+    if (!condition) {
+        throw std::runtime_error(std::format("check failed: {}", what));
+    }
+};
+
+namespace atom::ecs {
+
+template <>
+struct snapshot_serializer<std::string> {
+    static void save(std::ostream& out, const std::string& value) {
+        const auto size = static_cast<std::uint64_t>(value.size());
+        out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    static auto load(std::istream& in) -> std::string {
+        std::uint64_t size{};
+        in.read(reinterpret_cast<char*>(&size), sizeof(size));
+        std::string value(in ? static_cast<std::size_t>(size) : 0, '\0');
+        in.read(value.data(), static_cast<std::streamsize>(value.size()));
+        if (!in) {
+            throw std::runtime_error("Broken string in a snapshot!");
+        }
+        return value;
+    }
+};
+
+} // namespace atom::ecs
 
 void startup(command& command, queryer& queryer) {
     auto first_entity = command.spawn<std::string>("the first");
@@ -71,6 +120,8 @@ struct model {
     using proxy_type = proxy;
     using key_type   = std::string;
 
+    [[nodiscard]] static auto load(const std::string& path) -> proxy { return {}; }
+
     [[nodiscard]] auto type() -> asset_type { return asset_type::model; }
 
     [[nodiscard]] auto get_handle() const noexcept { return handle_; }
@@ -84,28 +135,493 @@ private:
     resource_handle handle_;
 };
 
+struct position {
+    constexpr static auto storage_policy_v = storage_policy::table;
+    float x;
+    float y;
+};
+
+struct velocity {
+    constexpr static auto storage_policy_v = storage_policy::table;
+    float x;
+    float y;
+};
+
+struct health {
+    int value;
+};
+
+struct label {
+    constexpr static auto storage_policy_v = storage_policy::table;
+    std::string text;
+};
+
+struct frame_count {
+    int value;
+};
+
+struct title {
+    std::string text;
+};
+
+namespace atom::ecs {
+
+template <>
+struct snapshot_serializer<label> {
+    static void save(std::ostream& out, const label& value) {
+        snapshot_serializer<std::string>::save(out, value.text);
+    }
+
+    static auto load(std::istream& in) -> label {
+        return { snapshot_serializer<std::string>::load(in) };
+    }
+};
+
+template <>
+struct snapshot_serializer<title> {
+    static void save(std::ostream& out, const title& value) {
+        snapshot_serializer<std::string>::save(out, value.text);
+    }
+
+    static auto load(std::istream& in) -> title {
+        return { snapshot_serializer<std::string>::load(in) };
+    }
+};
+
+} // namespace atom::ecs
+
+void startup_movement(command& command, queryer& queryer) {
+    command.spawn<position, velocity>(position{ 0.F, 0.F }, velocity{ 1.F, 2.F });
+    command.spawn<position>(position{ 5.F, 5.F });
+}
+
+void update_movement(command& command, queryer& queryer, float delta_time) {
+    for (auto entity : queryer.query_all_of<position, velocity>()) {
+        auto& pos       = queryer.get<position>(entity);
+        const auto& vel = queryer.get<const velocity>(entity);
+        pos.x += vel.x * delta_time;
+        pos.y += vel.y * delta_time;
+    }
+}
+
 void startup_model(command& command, queryer& queryer) {}
 
 void update_model(command& command, queryer& queryer, float delta_time) {
     auto non_model_entities = queryer.query_non_of<model>();
 
     for (auto entity : non_model_entities) {
-        command.attach<model>(entity);
-        auto& curr_model = queryer.get<model>(entity);
-
-        auto& hub           = hub::instance();
-        library<model>& lib = hub.library<model>();
-        auto& table         = hub.table<model>();
-        auto& path          = curr_model.path();
-        if (!table.contains(path)) {
-            auto [handle, ptr] = lib.install(model::proxy{});
-            table.emplace(path, handle);
-        }
+        // loaded in the background, the handle holds a placeholder until then.
+        model curr_model;
+        auto load = hub::instance().load_async<model>(curr_model.path());
+        curr_model.set_handle(load.handle());
+        command.attach<model>(entity, std::move(curr_model));
     }
 }
 
 void shutdown_model(command& command, queryer& queryer) {}
 
+// whether opening a copy of a pack, changed by `patch`, is refused.
+template <typename Patch>
+auto rejects_pack(const std::filesystem::path& path, Patch&& patch) -> bool {
+    std::ifstream in{ path, std::ios::binary };
+    std::vector<char> bytes{ std::istreambuf_iterator<char>{ in },
+                             std::istreambuf_iterator<char>{} };
+    patch(bytes);
+
+    auto broken = path;
+    broken += ".broken";
+    std::ofstream{ broken, std::ios::binary }.write(bytes.data(), bytes.size());
+    try {
+        static_cast<void>(asset_pack::open(broken));
+    }
+    catch (const std::runtime_error&) {
+        std::filesystem::remove(broken);
+        return true;
+    }
+    std::filesystem::remove(broken);
+    return false;
+}
+
+void check_asset_pack() {
+    const auto path        = std::filesystem::temp_directory_path() / "atom_ecs_test.pack";
+    const std::string text = "bytes of an asset";
+
+    asset_pack_writer writer;
+    writer.add("text", std::as_bytes(std::span{ text }));
+    writer.add("empty", {});
+    writer.write(path);
+    {
+        const auto pack  = asset_pack::open(path);
+        const auto bytes = pack->find("text");
+        check(pack->size() == 2, "two entries in the pack");
+        check(
+            std::string_view{ reinterpret_cast<const char*>(bytes.data()), bytes.size() } == text,
+            "bytes of a key"
+        );
+        check(reinterpret_cast<std::uintptr_t>(bytes.data()) % 64 == 0, "aligned blob");
+        check(pack->contains("empty") && pack->find("empty").empty(), "empty blob");
+        check(!pack->contains("missing") && !pack->blob("missing"), "missing key");
+
+        const auto blob = pack->blob("text");
+        check(blob && blob.size == text.size(), "blob of a key");
+    }
+
+    using atom::ecs::internal::pack_entry;
+    using atom::ecs::internal::pack_header;
+    const auto header_of = [](std::vector<char>& bytes) {
+        return reinterpret_cast<pack_header*>(bytes.data());
+    };
+    check(
+        rejects_pack(path, [](std::vector<char>& bytes) { bytes.resize(sizeof(pack_header) + 8); }),
+        "truncated pack"
+    );
+    check(
+        rejects_pack(
+            path,
+            [&](std::vector<char>& bytes) {
+                header_of(bytes)->entry_count = header_of(bytes)->bucket_count;
+            }
+        ),
+        "as many entries as buckets"
+    );
+    check(
+        rejects_pack(path, [&](std::vector<char>& bytes) { header_of(bytes)->alignment = 48; }),
+        "alignment not a power of two"
+    );
+    check(
+        rejects_pack(
+            path,
+            [&](std::vector<char>& bytes) {
+                const auto* header = header_of(bytes);
+                auto* toc = reinterpret_cast<pack_entry*>(bytes.data() + header->toc_offset);
+                auto* entry = std::find_if(toc, toc + header->bucket_count, [](const auto& entry) {
+                    return entry.key_offset != 0;
+                });
+                entry->blob_offset = bytes.size();
+                entry->blob_size   = 1;
+            }
+        ),
+        "blob past the end"
+    );
+    std::filesystem::remove(path);
+}
+
+// offsets in a snapshot, see `world::save`: a header of 56 bytes, then blocks at multiples of 64.
+struct snapshot_layout {
+    // the free indices.
+    std::size_t free;
+    // the record of the first sparse set, then the number of its entities.
+    std::size_t storage;
+    // the entities of the first sparse set.
+    std::size_t storage_entities;
+};
+
+auto layout_of(const std::string& bytes) -> snapshot_layout {
+    const auto align = [](const std::size_t offset) { return (offset + 63) & ~std::size_t{ 63 }; };
+    std::uint64_t index_count{};
+    std::uint64_t free_count{};
+    std::memcpy(&index_count, bytes.data() + 16, sizeof(index_count));
+    std::memcpy(&free_count, bytes.data() + 24, sizeof(free_count));
+
+    const auto generations = align(56);
+    const auto alive       = align(generations + index_count * sizeof(entity::generation_t));
+    const auto free        = align(alive + (index_count + 63) / 64 * sizeof(std::uint64_t));
+    const auto storage     = free + free_count * sizeof(entity::index_t);
+    return { free, storage, align(storage + 3 * sizeof(std::uint64_t)) };
+}
+
+// whether loading `bytes` is refused, leaving `world` without entities and its resources as they
+// were.
+auto rejects_snapshot(world& world, const std::string& bytes) -> bool {
+    std::istringstream stream{ bytes, std::ios::binary };
+    try {
+        world.load(stream);
+    }
+    catch (const std::runtime_error&) {
+        auto queryer = world.query();
+        check(std::ranges::distance(queryer.query_all_of<>()) == 0, "no entities after a failure");
+        check(queryer.find<frame_count>()->value == 1, "resources kept after a failure");
+        return true;
+    }
+    return false;
+}
+
+void check_snapshot() {
+    std::string saved;
+    entity::id_t first{};
+    entity::id_t second{};
+    {
+        world source;
+        auto command = source.command();
+        first        = command.spawn<health, std::string, position>(
+            health{ 3 }, std::string{ "first" }, position{ 1.F, 2.F }
+        );
+        second = command.spawn<health, label>(health{ 4 }, label{ "second" });
+        command.add<frame_count>(frame_count{ 7 });
+        command.add<title>(title{ "saved" });
+
+        std::ostringstream stream{ std::ios::binary };
+        source.save(stream);
+        saved = std::move(stream).str();
+    }
+    {
+        world target;
+        target.command().add<frame_count>(frame_count{ 1 });
+        std::istringstream stream{ saved, std::ios::binary };
+        target.load(stream);
+
+        auto queryer = target.query();
+        check(queryer.exist(first) && queryer.exist(second), "entities loaded");
+        check(queryer.get<const health>(first).value == 3, "raw sparse component");
+        check(queryer.get<const health>(second).value == 4, "raw sparse component");
+        check(queryer.get<const std::string>(first) == "first", "serialized sparse component");
+        const auto& pos = queryer.get<const position>(first);
+        check(pos.x == 1.F && pos.y == 2.F, "raw table component");
+        check(queryer.get<const label>(second).text == "second", "serialized table component");
+        check(queryer.find<frame_count>()->value == 7, "raw resource replaced");
+        check(queryer.find<title>()->text == "saved", "serialized resource");
+    }
+
+    // two entities in one sparse set and two free indices, nothing else.
+    std::string plain;
+    {
+        world source;
+        auto command = source.command();
+        command.spawn<health>(health{ 1 });
+        command.spawn<health>(health{ 2 });
+        command.kill(command.spawn());
+        command.kill(command.spawn());
+
+        std::ostringstream stream{ std::ios::binary };
+        source.save(stream);
+        plain = std::move(stream).str();
+    }
+    const auto layout = layout_of(plain);
+
+    world target;
+    target.command().add<frame_count>(frame_count{ 1 });
+    const auto kept = target.command().spawn<health>(health{ 5 });
+    check(rejects_snapshot(target, saved.substr(0, saved.size() / 2)), "truncated snapshot");
+    check(!target.query().exist(kept), "entities dropped by a failed load");
+
+    auto duplicated_free = plain;
+    std::memcpy(
+        duplicated_free.data() + layout.free + sizeof(entity::index_t),
+        plain.data() + layout.free,
+        sizeof(entity::index_t)
+    );
+    check(rejects_snapshot(target, duplicated_free), "duplicated free index");
+
+    auto duplicated_entity = plain;
+    std::memcpy(
+        duplicated_entity.data() + layout.storage_entities + sizeof(entity::id_t),
+        plain.data() + layout.storage_entities,
+        sizeof(entity::id_t)
+    );
+    check(rejects_snapshot(target, duplicated_entity), "duplicated entity in a storage");
+
+    std::istringstream stream{ plain, std::ios::binary };
+    target.load(stream);
+    check(std::ranges::distance(target.query().query_all_of<>()) == 2, "loaded after failures");
+}
+
+// what `observe_health` saw in its latest run.
+struct health_changes {
+    std::size_t added;
+    std::size_t changed;
+    std::vector<entity::id_t> removed;
+};
+
+health_changes observed;
+
+void observe_health(command& command, queryer& queryer, float delta_time) {
+    observed           = {};
+    const auto healths = queryer.view<const health>();
+    healths.added<health>().each([](const health&) { ++observed.added; });
+    healths.changed<health>().each([](const health&) { ++observed.changed; });
+    std::ranges::copy(queryer.removed<health>(), std::back_inserter(observed.removed));
+}
+
+void check_change_detection() {
+    world world;
+    world.track_removals<health>();
+    world.add_update(observe_health);
+
+    const auto first = world.command().spawn<health>(health{ 1 });
+    world.update(0.F);
+    check(observed.added == 1 && observed.changed == 1, "an attach is added");
+    world.update(0.F);
+    check(observed.added == 0 && observed.changed == 0, "an attach is added once");
+
+    static_cast<void>(world.query().get<const health>(first));
+    world.update(0.F);
+    check(observed.changed == 0, "a const get is no change");
+    world.query().get<health>(first).value = 2;
+    world.update(0.F);
+    check(observed.added == 0 && observed.changed == 1, "a mutable get is a change");
+
+    const auto second = world.command().spawn<health>(health{ 3 });
+    world.command().detach<health>(first);
+    world.command().kill(second);
+    world.update(0.F);
+    check(
+        std::ranges::is_permutation(observed.removed, std::vector{ first, second }),
+        "a detach and a kill are removals"
+    );
+    world.update(0.F);
+    check(observed.removed.empty(), "removals are seen by one run");
+
+    // the next update clamps every stored tick.
+    for (component::tick_t i = 0; i < tick_clamp_interval; ++i) {
+        static_cast<void>(world.query());
+    }
+    world.update(0.F);
+    check(
+        observed.added == 0 && observed.changed == 0 && observed.removed.empty(),
+        "nothing new after clamping"
+    );
+
+    world.command().attach<health>(first, health{ 4 });
+    world.update(0.F);
+    check(observed.added == 1 && observed.changed == 1, "an attach is added after clamping");
+    world.query().get<health>(first).value = 5;
+    world.update(0.F);
+    check(observed.added == 0 && observed.changed == 1, "a change after clamping");
+    world.command().detach<health>(first);
+    world.update(0.F);
+    check(observed.removed == std::vector{ first }, "a removal after clamping");
+}
+
+void check_cached_query() {
+    world world;
+    auto& unlabeled   = world.make_query<all<health>, none<label>>();
+    auto& all_healthy = world.make_query<all<const health>>();
+
+    auto command      = world.command();
+    const auto first  = command.spawn<health>(health{ 1 });
+    const auto second = command.spawn<health, label>(health{ 2 }, label{ "second" });
+    command.spawn<label>(label{ "third" });
+    check(unlabeled.contains(first) && !unlabeled.contains(second), "matched when made");
+    check(unlabeled.size() == 1 && all_healthy.size() == 2, "matched sizes");
+
+    command.attach<label>(first, label{ "first" });
+    check(!unlabeled.contains(first) && unlabeled.empty(), "left by an attach");
+    command.detach<label>(second);
+    check(unlabeled.contains(second) && unlabeled.size() == 1, "entered by a detach");
+    command.kill(second);
+    check(!unlabeled.contains(second) && unlabeled.empty(), "left by a kill");
+    check(all_healthy.contains(first) && all_healthy.size() == 1, "const filter");
+    command.detach<label>(first);
+    check(std::ranges::equal(unlabeled, std::vector{ first }), "entered again");
+}
+
+// systems running now and those of them writing `health`, set when two ran together wrongly.
+std::atomic<int> running_systems;
+std::atomic<int> running_writers;
+std::atomic<int> system_runs;
+std::atomic<bool> overlapped;
+
+// long enough for a system that is allowed to overlap to start meanwhile.
+void occupy() { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }
+
+template <int Id>
+struct health_writer {
+    using writes = std::tuple<health>;
+
+    static void update(command& command, queryer& queryer, float delta_time) {
+        ++running_systems;
+        if (running_writers++ != 0) {
+            overlapped = true;
+        }
+        occupy();
+        --running_writers;
+        --running_systems;
+        ++system_runs;
+    }
+};
+
+template <int Id>
+struct position_reader {
+    using reads = std::tuple<const position>;
+
+    static void update(command& command, queryer& queryer, float delta_time) {
+        ++running_systems;
+        occupy();
+        --running_systems;
+        ++system_runs;
+    }
+};
+
+void update_exclusively(command& command, queryer& queryer, float delta_time) {
+    if (running_systems++ != 0) {
+        overlapped = true;
+    }
+    occupy();
+    if (running_systems-- != 1) {
+        overlapped = true;
+    }
+    ++system_runs;
+}
+
+void check_scheduling() {
+    world world;
+    world.add_system<health_writer<0>>();
+    world.add_system<position_reader<0>>();
+    world.add_system<health_writer<1>>();
+    world.add_update(update_exclusively);
+    world.add_system<position_reader<1>>();
+    world.add_system<health_writer<2>>();
+
+    for (auto i = 0; i < 3; ++i) {
+        world.update(0.F);
+    }
+    check(system_runs == 18, "every system ran");
+    check(!overlapped, "writers of a component and undeclared systems run alone");
+}
+
+// what the systems of `check_deferred_spawn` saw of the entities spawned by `health_spawner`.
+entity::id_t spawned;
+bool seen_by_spawner;
+bool seen_after_sync;
+std::size_t healthy_after_sync;
+
+struct health_spawner {
+    using reads  = std::tuple<const label>;
+    using writes = std::tuple<health>;
+
+    static void update(command& command, queryer& queryer, float delta_time) {
+        spawned         = command.spawn<health>(health{ 7 });
+        seen_by_spawner = queryer.exist(spawned);
+        // one more for each label, spawned by the threads of a parallel loop.
+        queryer.view<const label>().par_each(
+            [&command](const label&) { command.spawn<health>(health{ 8 }); }, 1
+        );
+    }
+};
+
+void observe_spawned(command& command, queryer& queryer, float delta_time) {
+    seen_after_sync    = queryer.exist(spawned) && queryer.get<const health>(spawned).value == 7;
+    healthy_after_sync = static_cast<std::size_t>(
+        std::ranges::distance(queryer.query_all_of<health>())
+    );
+}
+
+void check_deferred_spawn() {
+    world world;
+    auto command = world.command();
+    for (auto i = 0; i < 4; ++i) {
+        command.spawn<label>(label{ std::to_string(i) });
+    }
+
+    // the undeclared system runs after a sync point.
+    world.add_system<health_spawner>();
+    world.add_update(observe_spawned);
+    world.update(0.F);
+    check(!seen_by_spawner, "a spawn is deferred in a declared system");
+    check(seen_after_sync, "a spawn is applied at the sync point");
+    check(healthy_after_sync == 5, "spawns of a parallel loop are applied at the sync point");
+}
+
 int main() {
     // generator
     {
@@ -140,6 +656,84 @@ int main() {
     catch (const std::exception& e) {
         println(e.what());
     }
+    // table components
+    try {
+        world world;
+
+        world.add_startup(startup_movement);
+        world.add_update(update_movement);
 
+        world.startup();
+        world.update(1.F);
+        world.update(1.F);
+
+        auto queryer       = world.query();
+        std::size_t moving = 0;
+        for (auto entity : queryer.query_all_of<position>()) {
+            const auto& pos = queryer.get<const position>(entity);
+            if (queryer.all_of<velocity>(entity)) {
+                check(pos.x == 2.F && pos.y == 4.F, "moved by its velocity");
+                ++moving;
+            }
+            else {
+                check(pos.x == 5.F && pos.y == 5.F, "kept without a velocity");
+            }
+        }
+        check(moving == 1, "one moving entity");
+        world.shutdown();
+    }
+    catch (const std::exception& e) {
+        println(e.what());
+        return 1;
+    }
+
+    // asset packs
+    try {
+        check_asset_pack();
+    }
+    catch (const std::exception& e) {
+        println(e.what());
+        return 1;
+    }
+    // snapshots
+    try {
+        check_snapshot();
+    }
+    catch (const std::exception& e) {
+        println(e.what());
+        return 1;
+    }
+    // change detection
+    try {
+        check_change_detection();
+    }
+    catch (const std::exception& e) {
+        println(e.what());
+        return 1;
+    }
+    // cached queries
+    try {
+        check_cached_query();
+    }
+    catch (const std::exception& e) {
+        println(e.what());
+        return 1;
+    }
+    // scheduling by declared access
+    try {
+        check_scheduling();
+    }
+    catch (const std::exception& e) {
+        println(e.what());
+        return 1;
+    }
+    // deferred commands
+    try {
+        check_deferred_spawn();
+    }
+    catch (const std::exception& e) {
+        println(e.what());
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include "asset_pack.hpp"
+
+using namespace atom::ecs;
+
+namespace fs = std::filesystem;
+
+// packer <output> <directory> [alignment]
+// packs the regular files under the directory, keyed by their paths relative to it, e.g.
+// `models/tree.obj`.
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        std::cerr << "usage: packer <output> <directory> [alignment]\n";
+        return 1;
+    }
+
+    std::uint32_t alignment = 64;
+    if (argc == 4) {
+        const std::string_view text = argv[3];
+        const auto* end             = text.data() + text.size();
+        const auto [ptr, error]     = std::from_chars(text.data(), end, alignment);
+        if (error != std::errc{} || ptr != end) {
+            std::cerr << "invalid alignment: " << text << '\n';
+            return 1;
+        }
+    }
+
+    try {
+        const fs::path root = argv[2];
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::recursive_directory_iterator{ root }) {
+            if (entry.is_regular_file()) {
+                files.emplace_back(entry.path());
+            }
+        }
+        // the order of a directory is not stable, sorted the same tree always makes the same pack.
+        std::ranges::sort(files);
+
+        asset_pack_writer writer{ alignment };
+        for (const auto& file : files) {
+            writer.add_file(file.lexically_relative(root).generic_string(), file);
+        }
+        writer.write(argv[1]);
+        std::cout << "packed " << writer.size() << " assets into " << argv[1] << '\n';
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}